@@ -7,8 +7,21 @@
 #include <tuple>
 #include <charconv>
 #include <map>
+#include <algorithm>
 #include <cstring>
+#include <cmath>
 #include <fstream>
+#include <sstream>
+#include <memory>
+#include <optional>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <queue>
+#include <getopt.h>
+#include <glob.h>
 #include <google/sparse_hash_map>
 #include <google/dense_hash_map>
 #include <boost/container_hash/hash.hpp>
@@ -21,7 +34,16 @@
 
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/stat.h>
 #include <dateutil.hh>
+#include <linereader.hh>
+#include <split.hh>
+#include <schema.hh>
+#include <arena.hh>
+#include <tsm.hh>
+#include <telemetry.hh>
+#include <spill.hh>
+#include <summarystore.hh>
 
 using namespace std;
 using namespace std::literals;
@@ -29,7 +51,7 @@ using google::sparse_hash_map;
 using google::dense_hash_map;
 
 /** 
- * From stdin, parses influxDB export, which contains one line per key/value datapoint 
+ * From stdin (or a file), parses influxDB export, which contains one line per key/value datapoint 
  * collected at a given timestamp. Keys correspond to fields in Event, SysInfo, or VideoSent.
  * To stdout, outputs summary of each stream (one stream per line).
  * Takes experimental settings and date as arguments.
@@ -49,27 +71,6 @@ size_t memcheck() {
     return usage.ru_maxrss;
 }
 
-// if delimiter is at end, adds empty string to ret
-void split_on_char(const string_view str, const char ch_to_find, vector<string_view> & ret) {
-    ret.clear();
-
-    bool in_double_quoted_string = false;
-    unsigned int field_start = 0;   // start of next token
-    for (unsigned int i = 0; i < str.size(); i++) {
-        const char ch = str[i];
-        if (ch == '"') {
-            in_double_quoted_string = !in_double_quoted_string;
-        } else if (in_double_quoted_string) {
-            continue;
-        } else if (ch == ch_to_find) {
-            ret.emplace_back(str.substr(field_start, i - field_start));
-            field_start = i + 1;
-        }
-    }
-
-    ret.emplace_back(str.substr(field_start));
-}
-
 uint64_t to_uint64(string_view str) {
     uint64_t ret = -1;
     const auto [ptr, ignore] = from_chars(str.data(), str.data() + str.size(), ret);
@@ -81,7 +82,38 @@ uint64_t to_uint64(string_view str) {
     return ret;
 }
 
-float to_float(const string_view str) {
+/* Parse a string of up to 19 digits (so it can't overflow), eight digits at a time.
+ * Returns false if str is empty, too long, or contains a non-digit. */
+bool parse_digits(const string_view str, uint64_t & ret) {
+    if (str.empty() or str.size() > 19) {
+        return false;
+    }
+    ret = 0;
+    size_t i = 0;
+    for (; i + 8 <= str.size(); i += 8) {
+        uint64_t chunk;
+        memcpy(&chunk, str.data() + i, 8);
+        // every byte 0x30..0x39?
+        if (((chunk & 0xF0F0F0F0F0F0F0F0) | (((chunk + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4))
+                != 0x3333333333333333) {
+            return false;
+        }
+        // combine digit pairs, then pairs of pairs, then the two halves
+        chunk = (chunk & 0x0F0F0F0F0F0F0F0F) * 2561 >> 8;
+        chunk = (chunk & 0x00FF00FF00FF00FF) * 6553601 >> 16;
+        ret = ret * 100000000 + ((chunk & 0x0000FFFF0000FFFF) * 42949672960001 >> 32);
+    }
+    for (; i < str.size(); i++) {
+        const unsigned int digit = str[i] - '0';
+        if (digit > 9) {
+            return false;
+        }
+        ret = ret * 10 + digit;
+    }
+    return true;
+}
+
+double to_double(const string_view str) {
     /* sadly, g++ 8 doesn't seem to have floating-point C++17 from_chars() yet
        float ret;
        const auto [ptr, ignore] = from_chars(str.data(), str.data() + str.size(), ret);
@@ -92,14 +124,15 @@ float to_float(const string_view str) {
        return ret;
        */
 
-    /* apologies for this */
-    char * const null_byte = const_cast<char *>(str.data() + str.size());
-    char old_value = *null_byte;
-    *null_byte = 0;
-
-    const float ret = atof(str.data());
+    /* copy into a null-terminated buffer rather than writing into the (read-only) input */
+    char buf[64];
+    if (str.size() >= sizeof(buf)) {
+        throw runtime_error("could not parse as float: " + string(str));
+    }
+    memcpy(buf, str.data(), str.size());
+    buf[str.size()] = 0;
 
-    *null_byte = old_value;
+    const double ret = atof(buf);
 
     return ret;
 }
@@ -116,6 +149,57 @@ T influx_integer(const string_view str) {
     return static_cast<T>(ret_64);
 }
 
+/* The same, for a value read from TSM */
+template <typename T>
+T influx_integer(const tsm::Value & value) {
+    if (value.type != tsm::BlockType::integer) {
+        throw runtime_error("invalid influx integer: value of type " + to_string(int(value.type)));
+    }
+    if (value.integer < 0 or uint64_t(value.integer) > numeric_limits<T>::max()) {
+        throw runtime_error("can't convert to uint32_t: " + to_string(value.integer));
+    }
+    return static_cast<T>(value.integer);
+}
+
+double influx_float(const string_view str) {
+    return to_double(str);
+}
+
+double influx_float(const tsm::Value & value) {
+    if (value.type != tsm::BlockType::float64) {
+        throw runtime_error("invalid influx float: value of type " + to_string(int(value.type)));
+    }
+    return value.float64;
+}
+
+/* Value of a string field, e.g. "Chrome" => Chrome (quoted in export, not in TSM) */
+string_view influx_string(const string_view str) {
+    return str.substr(1, str.size() - 2);
+}
+
+string_view influx_string(const tsm::Value & value) {
+    if (value.type != tsm::BlockType::string) {
+        throw runtime_error("invalid influx string: value of type " + to_string(int(value.type)));
+    }
+    return value.string;
+}
+
+/* Value of a user field, which must be a nonempty string */
+string_view influx_username(const string_view str) {
+    if (str.size() <= 2 or str.front() != '"' or str.back() != '"') {
+        throw runtime_error("invalid username string: " + string(str));
+    }
+    return influx_string(str);
+}
+
+string_view influx_username(const tsm::Value & value) {
+    const string_view username = influx_string(value);
+    if (username.empty()) {
+        throw runtime_error("invalid username string: empty");
+    }
+    return username;
+}
+
 constexpr uint8_t SERVER_COUNT = 255;
 
 // server_id identifies a daemon serving a given scheme
@@ -135,98 +219,138 @@ uint64_t get_server_id(const vector<string_view> & fields) {
     return server_id;
 }
 
+/* Interns names (usernames, browsers, OS names) as dense ids. Lookups take a string_view, so finding
+ * a name that's already interned allocates nothing; each new name is copied once into names_. */
 class string_table {
-    uint32_t next_id_ = 0;
+    Arena names_{64 * 1024};
+    string scratch_{};  // reused by forward_map_vivify_replacing
 
-    dense_hash_map<string, uint32_t> forward_{};
-    dense_hash_map<uint32_t, string> reverse_{};
+    dense_hash_map<string_view, uint32_t> forward_{};  // views into names_
+    vector<string_view> reverse_{};                    // indexed by id
 
     public:
     string_table() {
         forward_.set_empty_key({});
-        reverse_.set_empty_key(-1);
     }
 
-    uint32_t forward_map_vivify(const string & name) {
-        auto ref = forward_.find(name);
-        if (ref == forward_.end()) {	
-            forward_[name] = next_id_;
-            reverse_[next_id_] = name;
-            next_id_++;
-            ref = forward_.find(name);
+    uint32_t forward_map_vivify(const string_view name) {
+        const auto ref = forward_.find(name);
+        if (ref != forward_.end()) {
+            return ref->second;
         }
-        return ref->second;
+        char * const stored = names_.allocate<char>(name.size());
+        memcpy(stored, name.data(), name.size());
+        const uint32_t id = reverse_.size();
+        reverse_.emplace_back(stored, name.size());
+        forward_[reverse_.back()] = id;
+        return id;
+    }
+
+    /* forward_map_vivify of name with each from replaced by to */
+    uint32_t forward_map_vivify_replacing(const string_view name, const char from, const char to) {
+        if (name.find(from) == name.npos) {
+            return forward_map_vivify(name);
+        }
+        scratch_.assign(name);
+        replace(scratch_.begin(), scratch_.end(), from, to);
+        return forward_map_vivify(scratch_);
     }
 
-    uint32_t forward_map(const string & name) const {
-        auto ref = forward_.find(name);
-        if (ref == forward_.end()) {	
-            throw runtime_error( "username " + name + " not found");
+    uint32_t forward_map(const string_view name) const {
+        const auto ref = forward_.find(name);
+        if (ref == forward_.end()) {
+            throw runtime_error( "username " + string(name) + " not found");
         }
         return ref->second;
     }
 
-    const string & reverse_map(const uint32_t id) const {
-        auto ref = reverse_.find(id);
-        if (ref == reverse_.end()) {
+    string_view reverse_map(const uint32_t id) const {
+        if (id >= reverse_.size()) {
             throw runtime_error( "uid " + to_string(id) + " not found");
         }
-        return ref->second;
+        return reverse_[id];
     }
+
+    // ids are 0 .. size() - 1
+    uint32_t size() const { return reverse_.size(); }
+};
+
+/* A value parsed from one line of export (or one point of TSM), for one field of an Event, Sysinfo, or VideoSent.
+ * value holds the field's bits (uint32_t, float, or enum); Field::none marks an ignored key,
+ * which still creates the record at that timestamp (as it always has). */
+template <class Field>
+struct FieldUpdate {
+    Field field;
+    uint32_t value;
 };
 
-struct Event {
-    struct EventType {
-        enum class Type : uint8_t { init, startup, play, timer, rebuffer };
-        constexpr static array<string_view, 5> names = { "init", "startup", "play", "timer", "rebuffer" };
+uint32_t float_to_bits(const float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+float bits_to_float(const uint32_t bits) {
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
 
-        Type type;
+/* Which fields of a record are set (bit i for Field i), in place of an engaged flag per field */
+template <class Field>
+class FieldMask {
+    uint8_t bits_ = 0;
 
-        operator string_view() const { return names[uint8_t(type)]; }
+    static uint8_t bit(const Field field) { return 1 << uint8_t(field); }
 
-        EventType(const string_view sv)
-            : type()
-        {
-            if (sv == "timer"sv) { type = Type::timer; }
-            else if (sv == "play"sv) { type = Type::play; }
-            else if (sv == "rebuffer"sv) { type = Type::rebuffer; }
-            else if (sv == "init"sv) { type = Type::init; }
-            else if (sv == "startup"sv) { type = Type::startup; }
-            else { throw runtime_error( "unknown event type: " + string(sv) ); }
+    public:
+    bool has(const Field field) const { return bits_ & bit(field); }
+    void set(const Field field) { bits_ |= bit(field); }
+    void clear(const Field field) { bits_ &= ~bit(field); }
+
+    bool has_all(const initializer_list<Field> fields) const {
+        for (const Field field : fields) {
+            if (not has(field)) {
+                return false;
+            }
         }
+        return true;
+    }
 
-        operator uint8_t() const { return static_cast<uint8_t>(type); }
+    template <typename T>
+    optional<T> get(const Field field, const T & value) const {
+        return has(field) ? optional<T>(value) : nullopt;
+    }
+};
 
-        bool operator==(const EventType other) const { return type == other.type; }
-        bool operator==(const EventType::Type other) const { return type == other; }
-        bool operator!=(const EventType other) const { return not operator==(other); }
-        bool operator!=(const EventType::Type other) const { return not operator==(other); }
-    };
+/* Records are stored packed, with one presence bit per field; fields are read through
+ * accessors returning optional (nullopt if unset). */
+class Event {
+    public:
+    using EventType = ::EventType;
 
+    using Field = EventField;
+    using Update = FieldUpdate<Field>;
+
+    private:
     /* After 11/27, all measurements are recorded with both first_init_id (identifies session) 
      * and init_id (identifies stream). Before 11/27, only init_id is recorded. */
-    optional<uint32_t> first_init_id{}; // optional
-    optional<uint32_t> init_id{};       // mandatory
-    optional<uint32_t> expt_id{};
-    optional<uint32_t> user_id{};
-    optional<EventType> type{};
-    optional<float> buffer{};
-    optional<float> cum_rebuf{};
-
-    bool bad = false;
-
-    // Event is "complete" and "good" if all mandatory fields are set exactly once
-    bool complete() const {
-        return init_id.has_value() and expt_id.has_value() and user_id.has_value()
-            and type.has_value() and buffer.has_value() and cum_rebuf.has_value();
-    }
+    uint32_t first_init_id_ = 0;    // optional
+    uint32_t init_id_ = 0;          // mandatory
+    uint32_t expt_id_ = 0;
+    uint32_t user_id_ = 0;
+    float buffer_ = 0;              // seconds
+    float cum_rebuf_ = 0;
+    EventType::Type type_{};
+    FieldMask<Field> present_{};
 
     template <typename T>
-        void set_unique( optional<T> & field, const T & value ) {
-            if (not field.has_value()) { 
-                field.emplace(value);
+        void set_unique( const Field field, T & member, const T & value ) {
+            if (not present_.has(field)) {
+                member = value;
+                present_.set(field);
             } else {
-                if (field.value() != value) {
+                if (member != value) {
                     if (not bad) {
                         bad = true;
                         cerr << "error trying to set contradictory event value: ";
@@ -237,242 +361,399 @@ struct Event {
             }
         }
 
-    /* Set field corresponding to key, if not yet set for this Event.
-     * If field is already set with a different value, Event is "bad" */
-    void insert_unique(const string_view key, const string_view value, string_table & usernames ) {
-        if (key == "first_init_id"sv) {
-            set_unique( first_init_id, influx_integer<uint32_t>( value ) );
-        } else if (key == "init_id"sv) {
-            set_unique( init_id, influx_integer<uint32_t>( value ) );
-        } else if (key == "expt_id"sv) {
-            set_unique( expt_id, influx_integer<uint32_t>( value ) );
-        } else if (key == "user"sv) {
-            if (value.size() <= 2 or value.front() != '"' or value.back() != '"') {
-                throw runtime_error("invalid username string: " + string(value));
-            }
-            set_unique( user_id, usernames.forward_map_vivify(string(value.substr(1,value.size()-2))) );
-        } else if (key == "event"sv) {
-            set_unique( type, { value.substr(1,value.size()-2) } );
-        } else if (key == "buffer"sv) {
-            set_unique( buffer, to_float(value) );
-        } else if (key == "cum_rebuf"sv) {
-            set_unique( cum_rebuf, to_float(value) );
-        } else {
+    public:
+    bool bad = false;
+
+    optional<uint32_t> first_init_id() const { return present_.get(Field::first_init_id, first_init_id_); }
+    optional<uint32_t> init_id() const { return present_.get(Field::init_id, init_id_); }
+    optional<uint32_t> expt_id() const { return present_.get(Field::expt_id, expt_id_); }
+    optional<uint32_t> user_id() const { return present_.get(Field::user_id, user_id_); }
+    optional<EventType> type() const { return present_.get(Field::type, EventType{type_}); }
+    optional<float> buffer() const { return present_.get(Field::buffer, buffer_); }
+    optional<float> cum_rebuf() const { return present_.get(Field::cum_rebuf, cum_rebuf_); }
+
+    // Event is "complete" and "good" if all mandatory fields are set exactly once
+    bool complete() const {
+        return present_.has_all({ Field::init_id, Field::expt_id, Field::user_id,
+                                  Field::type, Field::buffer, Field::cum_rebuf });
+    }
+
+    /* Parse the value of field, from export text or TSM */
+    template <class Value>
+    static Update decode(const Field field, const Value & value, string_table & usernames ) {
+        switch (field) {
+            case Field::first_init_id:
+            case Field::init_id:
+            case Field::expt_id:
+                return { field, influx_integer<uint32_t>( value ) };
+            case Field::user_id:
+                return { Field::user_id, usernames.forward_map_vivify(influx_username(value)) };
+            case Field::type:
+                return { Field::type, uint8_t(EventType{ influx_string(value) }) };
+            case Field::buffer:
+            case Field::cum_rebuf:
+                return { field, float_to_bits(influx_float(value)) };
+            case Field::none:
+                break;
+        }
+        return { Field::none, 0 };
+    }
+
+    /* Parse the field corresponding to key */
+    static Update decode(const string_view key, const string_view value, string_table & usernames ) {
+        const optional<Field> field = event_fields.lookup(key);
+        if (not field) {
             throw runtime_error( "unknown key: " + string(key) );
         }
+        return decode(*field, value, usernames);
     }
-        
-    friend std::ostream& operator<<(std::ostream& out, const Event& s); 
-};
-std::ostream& operator<< (std::ostream& out, const Event& s) {        
-    return out << "init_id=" << s.init_id.value_or(-1)
-    << ", expt_id=" << s.expt_id.value_or(-1)
-    << ", user_id=" << s.user_id.value_or(-1)
-    << ", type=" << (s.type.has_value() ? int(s.type.value()) : 'x')
-    << ", buffer=" << s.buffer.value_or(-1.0)
-    << ", cum_rebuf=" << s.cum_rebuf.value_or(-1.0)
-    << ", first_init_id=" << s.first_init_id.value_or(-1)
-    << "\n";
-}
 
-struct Sysinfo {
-    optional<uint32_t> browser_id{};
-    optional<uint32_t> expt_id{};
-    optional<uint32_t> user_id{};
-    optional<uint32_t> first_init_id{}; // optional
-    optional<uint32_t> init_id{};       // mandatory
-    optional<uint32_t> os{};
-    optional<uint32_t> ip{};
+    /* Set field, if not yet set for this Event.
+     * If field is already set with a different value, Event is "bad" */
+    void apply(const Update update) {
+        switch (update.field) {
+            case Field::first_init_id: set_unique( update.field, first_init_id_, update.value ); break;
+            case Field::init_id: set_unique( update.field, init_id_, update.value ); break;
+            case Field::expt_id: set_unique( update.field, expt_id_, update.value ); break;
+            case Field::user_id: set_unique( update.field, user_id_, update.value ); break;
+            case Field::type: set_unique( update.field, type_, EventType::Type(update.value) ); break;
+            case Field::buffer: set_unique( update.field, buffer_, bits_to_float(update.value) ); break;
+            case Field::cum_rebuf: set_unique( update.field, cum_rebuf_, bits_to_float(update.value) ); break;
+            case Field::none: break;
+        }
+    }
 
-    bool bad = false;
+    /* Overwrite field, whether or not already set (e.g. to renumber an id) */
+    void replace(const Update update) {
+        present_.clear(update.field);
+        apply(update);
+    }
 
-    bool complete() const {
-        return browser_id and expt_id and user_id and init_id and os and ip;
+    /* Set the fields set in later -- the record with the same timestamp, from later in the export --
+     * as if later's updates had been applied to this one (see TimestampTable::spill) */
+    void merge(const Event & later) {
+        auto merge_field = [&](const Field field, auto & member, const auto & later_member) {
+            if (later.present_.has(field)) {
+                set_unique(field, member, later_member);
+            }
+        };
+        merge_field(Field::first_init_id, first_init_id_, later.first_init_id_);
+        merge_field(Field::init_id, init_id_, later.init_id_);
+        merge_field(Field::expt_id, expt_id_, later.expt_id_);
+        merge_field(Field::user_id, user_id_, later.user_id_);
+        merge_field(Field::type, type_, later.type_);
+        merge_field(Field::buffer, buffer_, later.buffer_);
+        merge_field(Field::cum_rebuf, cum_rebuf_, later.cum_rebuf_);
+        bad = bad or later.bad;
     }
 
-    bool operator==(const Sysinfo & other) const {
-        return browser_id == other.browser_id
-            and expt_id == other.expt_id
-            and user_id == other.user_id
-            and init_id == other.init_id
-            and os == other.os
-            and ip == other.ip
-            and first_init_id == first_init_id;
+    void insert_unique(const string_view key, const string_view value, string_table & usernames ) {
+        apply(decode(key, value, usernames));
     }
 
-    bool operator!=(const Sysinfo & other) const { return not operator==(other); }
+    friend std::ostream& operator<<(std::ostream& out, const Event& s); 
+};
+std::ostream& operator<< (std::ostream& out, const Event& s) {        
+    return out << "init_id=" << s.init_id().value_or(-1)
+    << ", expt_id=" << s.expt_id().value_or(-1)
+    << ", user_id=" << s.user_id().value_or(-1)
+    << ", type=" << (s.type().has_value() ? int(s.type().value()) : 'x')
+    << ", buffer=" << s.buffer().value_or(-1.0)
+    << ", cum_rebuf=" << s.cum_rebuf().value_or(-1.0)
+    << ", first_init_id=" << s.first_init_id().value_or(-1)
+    << "\n";
+}
+static_assert(sizeof(Event) <= 28, "Event should stay packed");
+
+class Sysinfo {
+    public:
+    using Field = SysinfoField;
+    using Update = FieldUpdate<Field>;
+
+    private:
+    uint32_t browser_id_ = 0;
+    uint32_t expt_id_ = 0;
+    uint32_t user_id_ = 0;
+    uint32_t first_init_id_ = 0;    // optional
+    uint32_t init_id_ = 0;          // mandatory
+    uint32_t os_ = 0;
+    uint32_t ip_ = 0;
+    FieldMask<Field> present_{};
 
     template <typename T>
-        void set_unique( optional<T> & field, const T & value ) {
-            if (not field.has_value()) {
-                field.emplace(value);
+        void set_unique( const Field field, T & member, const T & value ) {
+            if (not present_.has(field)) {
+                member = value;
+                present_.set(field);
             } else {
-                if (field.value() != value) {
+                if (member != value) {
                     if (not bad) {
                         bad = true;
                         cerr << "error trying to set contradictory sysinfo value: ";
-                        cerr << *this; 
+                        cerr << *this;   
                     }
                     //		throw runtime_error( "contradictory values: " + to_string(field.value()) + " vs. " + to_string(value) );
                 }
             }
         }
 
-    void insert_unique(const string_view key, const string_view value,
+    public:
+    bool bad = false;
+
+    optional<uint32_t> browser_id() const { return present_.get(Field::browser_id, browser_id_); }
+    optional<uint32_t> expt_id() const { return present_.get(Field::expt_id, expt_id_); }
+    optional<uint32_t> user_id() const { return present_.get(Field::user_id, user_id_); }
+    optional<uint32_t> first_init_id() const { return present_.get(Field::first_init_id, first_init_id_); }
+    optional<uint32_t> init_id() const { return present_.get(Field::init_id, init_id_); }
+    optional<uint32_t> os() const { return present_.get(Field::os, os_); }
+    optional<uint32_t> ip() const { return present_.get(Field::ip, ip_); }
+
+    bool complete() const {
+        return present_.has_all({ Field::browser_id, Field::expt_id, Field::user_id,
+                                  Field::init_id, Field::os, Field::ip });
+    }
+
+    bool operator==(const Sysinfo & other) const {
+        return browser_id() == other.browser_id()
+            and expt_id() == other.expt_id()
+            and user_id() == other.user_id()
+            and init_id() == other.init_id()
+            and os() == other.os()
+            and ip() == other.ip();
+    }
+
+    bool operator!=(const Sysinfo & other) const { return not operator==(other); }
+
+    template <class Value>
+    static Update decode(const Field field, const Value & value,
             string_table & usernames,
             string_table & browsers,
             string_table & ostable ) {
-        if (key == "first_init_id"sv) {
-            set_unique( first_init_id, influx_integer<uint32_t>( value ) );
-        } else if (key == "init_id"sv) {
-            set_unique( init_id, influx_integer<uint32_t>( value ) );
-        } else if (key == "expt_id"sv) {
-            set_unique( expt_id, influx_integer<uint32_t>( value ) );
-        } else if (key == "user"sv) {
-            if (value.size() <= 2 or value.front() != '"' or value.back() != '"') {
-                throw runtime_error("invalid username string: " + string(value));
-            }
-            set_unique( user_id, usernames.forward_map_vivify(string(value.substr(1,value.size()-2))) );
-        } else if (key == "browser"sv) {
-            set_unique( browser_id, browsers.forward_map_vivify(string(value.substr(1,value.size()-2))) );
-        } else if (key == "os"sv) {
-            string osname(value.substr(1,value.size()-2));
-            for (auto & x : osname) {
-                if ( x == ' ' ) { x = '_'; }
-            }
-            set_unique( os, ostable.forward_map_vivify(osname) );
-        } else if (key == "ip"sv) {
-            set_unique( ip, inet_addr(string(value.substr(1,value.size()-2)).c_str()) );
-        } else if (key == "screen_width"sv or key == "screen_height"sv) {
-            // ignore
-        } else {
+        switch (field) {
+            case Field::first_init_id:
+            case Field::init_id:
+            case Field::expt_id:
+                return { field, influx_integer<uint32_t>( value ) };
+            case Field::user_id:
+                return { Field::user_id, usernames.forward_map_vivify(influx_username(value)) };
+            case Field::browser_id:
+                return { Field::browser_id, browsers.forward_map_vivify(influx_string(value)) };
+            case Field::os:
+                return { Field::os, ostable.forward_map_vivify_replacing(influx_string(value), ' ', '_') };
+            case Field::ip:
+                return { Field::ip, inet_addr(string(influx_string(value)).c_str()) };
+            case Field::none:
+                break;  // ignore
+        }
+        return { Field::none, 0 };
+    }
+
+    static Update decode(const string_view key, const string_view value,
+            string_table & usernames,
+            string_table & browsers,
+            string_table & ostable ) {
+        const optional<Field> field = sysinfo_fields.lookup(key);
+        if (not field) {
             throw runtime_error( "unknown key: " + string(key) );
         }
+        return decode(*field, value, usernames, browsers, ostable);
     }
-    friend std::ostream& operator<<(std::ostream& out, const Sysinfo& s); 
-};
-std::ostream& operator<< (std::ostream& out, const Sysinfo& s) {        
-    return out << "init_id=" << s.init_id.value_or(-1)
-    << ", expt_id=" << s.expt_id.value_or(-1)
-    << ", user_id=" << s.user_id.value_or(-1)
-    << ", browser_id=" << (s.browser_id.value_or(-1))
-    << ", os=" << s.os.value_or(-1.0)
-    << ", ip=" << s.ip.value_or(-1.0)
-    << ", first_init_id=" << s.first_init_id.value_or(-1)
-    << "\n";
-}
 
-struct VideoSent {
-    optional<float> ssim_index{};
-    optional<uint32_t> delivery_rate{}, expt_id{}, init_id{}, first_init_id{}, user_id{}, size{};
+    void apply(const Update update) {
+        switch (update.field) {
+            case Field::browser_id: set_unique( update.field, browser_id_, update.value ); break;
+            case Field::expt_id: set_unique( update.field, expt_id_, update.value ); break;
+            case Field::user_id: set_unique( update.field, user_id_, update.value ); break;
+            case Field::first_init_id: set_unique( update.field, first_init_id_, update.value ); break;
+            case Field::init_id: set_unique( update.field, init_id_, update.value ); break;
+            case Field::os: set_unique( update.field, os_, update.value ); break;
+            case Field::ip: set_unique( update.field, ip_, update.value ); break;
+            case Field::none: break;
+        }
+    }
 
-    bool bad = false;
+    /* Overwrite field, whether or not already set (e.g. to renumber an id) */
+    void replace(const Update update) {
+        present_.clear(update.field);
+        apply(update);
+    }
 
-    bool complete() const {
-        return ssim_index and delivery_rate and expt_id and init_id and user_id and size;
+    /* Set the fields set in later -- the record with the same timestamp, from later in the export --
+     * as if later's updates had been applied to this one (see TimestampTable::spill) */
+    void merge(const Sysinfo & later) {
+        auto merge_field = [&](const Field field, auto & member, const auto & later_member) {
+            if (later.present_.has(field)) {
+                set_unique(field, member, later_member);
+            }
+        };
+        merge_field(Field::browser_id, browser_id_, later.browser_id_);
+        merge_field(Field::expt_id, expt_id_, later.expt_id_);
+        merge_field(Field::user_id, user_id_, later.user_id_);
+        merge_field(Field::first_init_id, first_init_id_, later.first_init_id_);
+        merge_field(Field::init_id, init_id_, later.init_id_);
+        merge_field(Field::os, os_, later.os_);
+        merge_field(Field::ip, ip_, later.ip_);
+        bad = bad or later.bad;
     }
 
-    bool operator==(const VideoSent & other) const {
-        return ssim_index == other.ssim_index
-            and delivery_rate == other.delivery_rate
-            and expt_id == other.expt_id
-            and init_id == other.init_id
-            and user_id == other.user_id
-            and size == other.size
-            and first_init_id == first_init_id;
+    void insert_unique(const string_view key, const string_view value,
+            string_table & usernames,
+            string_table & browsers,
+            string_table & ostable ) {
+        apply(decode(key, value, usernames, browsers, ostable));
     }
+    friend std::ostream& operator<<(std::ostream& out, const Sysinfo& s); 
+};
+std::ostream& operator<< (std::ostream& out, const Sysinfo& s) {        
+    return out << "init_id=" << s.init_id().value_or(-1)
+    << ", expt_id=" << s.expt_id().value_or(-1)
+    << ", user_id=" << s.user_id().value_or(-1)
+    << ", browser_id=" << (s.browser_id().value_or(-1))
+    << ", os=" << s.os().value_or(-1.0)
+    << ", ip=" << s.ip().value_or(-1.0)
+    << ", first_init_id=" << s.first_init_id().value_or(-1)
+    << "\n";
+}
+static_assert(sizeof(Sysinfo) <= 32, "Sysinfo should stay packed");
 
-    bool operator!=(const VideoSent & other) const { return not operator==(other); }
+class VideoSent {
+    public:
+    using Field = VideoSentField;
+    using Update = FieldUpdate<Field>;
+
+    private:
+    float ssim_index_ = 0;          // raw index
+    uint32_t delivery_rate_ = 0, expt_id_ = 0, init_id_ = 0, first_init_id_ = 0, user_id_ = 0, size_ = 0;
+    FieldMask<Field> present_{};
 
     template <typename T>
-        void set_unique( optional<T> & field, const T & value ) {
-            if (not field.has_value()) {
-                field.emplace(value);
+        void set_unique( const Field field, T & member, const T & value ) {
+            if (not present_.has(field)) {
+                member = value;
+                present_.set(field);
             } else {
-                if (field.value() != value) {
+                if (member != value) {
                     if (not bad) {
                         bad = true;
                         cerr << "error trying to set contradictory videosent value: ";
-                        cerr << *this; 
+                        cerr << *this;   
                     }
                     //		throw runtime_error( "contradictory values: " + to_string(field.value()) + " vs. " + to_string(value) );
                 }
             }
         }
-    
-    void insert_unique(const string_view key, const string_view value,
-            string_table & usernames ) {
-        if (key == "first_init_id"sv) {
-            set_unique( first_init_id, influx_integer<uint32_t>( value ) );
-        } else if (key == "init_id"sv) {
-            set_unique( init_id, influx_integer<uint32_t>( value ) );
-        } else if (key == "expt_id"sv) {
-            set_unique( expt_id, influx_integer<uint32_t>( value ) );
-        } else if (key == "user"sv) {
-            if (value.size() <= 2 or value.front() != '"' or value.back() != '"') {
-                throw runtime_error("invalid username string: " + string(value));
-            }
-            set_unique( user_id, usernames.forward_map_vivify(string(value.substr(1,value.size()-2))) );
-        } else if (key == "ssim_index"sv) {
-            set_unique( ssim_index, to_float(value) );
-        } else if (key == "delivery_rate"sv) {
-            set_unique( delivery_rate, influx_integer<uint32_t>( value ) );
-        } else if (key == "size"sv) {
-            set_unique( size, influx_integer<uint32_t>( value ) );
-        } else if (key == "buffer"sv or key == "cum_rebuffer"sv
-                or key == "cwnd"sv or key == "format"sv or key == "in_flight"sv
-                or key == "min_rtt"sv or key == "rtt"sv
-                or key == "video_ts"sv) {
-            // ignore
-        } else {
-            throw runtime_error( "unknown key: " + string(key) );
-        }
+
+    public:
+    bool bad = false;
+
+    optional<float> ssim_index() const { return present_.get(Field::ssim_index, ssim_index_); }
+    optional<uint32_t> delivery_rate() const { return present_.get(Field::delivery_rate, delivery_rate_); }
+    optional<uint32_t> expt_id() const { return present_.get(Field::expt_id, expt_id_); }
+    optional<uint32_t> init_id() const { return present_.get(Field::init_id, init_id_); }
+    optional<uint32_t> first_init_id() const { return present_.get(Field::first_init_id, first_init_id_); }
+    optional<uint32_t> user_id() const { return present_.get(Field::user_id, user_id_); }
+    optional<uint32_t> size() const { return present_.get(Field::size, size_); }
+
+    bool complete() const {
+        return present_.has_all({ Field::ssim_index, Field::delivery_rate, Field::expt_id,
+                                  Field::init_id, Field::user_id, Field::size });
     }
-    friend std::ostream& operator<<(std::ostream& out, const VideoSent& s); 
-};
-std::ostream& operator<< (std::ostream& out, const VideoSent& s) {        
-    return out << "init_id=" << s.init_id.value_or(-1)
-        << ", expt_id=" << s.expt_id.value_or(-1)
-        << ", user_id=" << s.user_id.value_or(-1)
-        << ", ssim_index=" << s.ssim_index.value_or(-1)
-        << ", delivery_rate=" << s.delivery_rate.value_or(-1)
-        << ", size=" << s.size.value_or(-1)
-        << ", first_init_id=" << s.first_init_id.value_or(-1)
-        << "\n";
-}
 
-struct Channel {
-    constexpr static uint8_t COUNT = 9;
+    bool operator==(const VideoSent & other) const {
+        return ssim_index() == other.ssim_index()
+            and delivery_rate() == other.delivery_rate()
+            and expt_id() == other.expt_id()
+            and init_id() == other.init_id()
+            and user_id() == other.user_id()
+            and size() == other.size();
+    }
 
-    enum class ID : uint8_t { cbs, nbc, abc, fox, univision, pbs, cw, ion, mnt };
+    bool operator!=(const VideoSent & other) const { return not operator==(other); }
 
-    constexpr static array<string_view, COUNT> names = { "cbs", "nbc", "abc", "fox", "univision", "pbs", "cw", "ion", "mnt" };
+    template <class Value>
+    static Update decode(const Field field, const Value & value,
+            string_table & usernames ) {
+        switch (field) {
+            case Field::first_init_id:
+            case Field::init_id:
+            case Field::expt_id:
+                return { field, influx_integer<uint32_t>( value ) };
+            case Field::user_id:
+                return { Field::user_id, usernames.forward_map_vivify(influx_username(value)) };
+            case Field::ssim_index:
+                return { Field::ssim_index, float_to_bits(influx_float(value)) };
+            case Field::delivery_rate:
+            case Field::size:
+                return { field, influx_integer<uint32_t>( value ) };
+            case Field::none:
+                break;  // ignore
+        }
+        return { Field::none, 0 };
+    }
 
-    ID id;
+    static Update decode(const string_view key, const string_view value,
+            string_table & usernames ) {
+        const optional<Field> field = video_sent_fields.lookup(key);
+        if (not field) {
+            throw runtime_error( "unknown key: " + string(key) );
+        }
+        return decode(*field, value, usernames);
+    }
 
-    constexpr Channel(const string_view sv)
-        : id()
-    {
-        if (sv == "cbs"sv) { id = ID::cbs; }
-        else if (sv == "nbc"sv) { id = ID::nbc; }
-        else if (sv == "abc"sv) { id = ID::abc; }
-        else if (sv == "fox"sv) { id = ID::fox; }
-        else if (sv == "univision"sv) { id = ID::univision; }
-        else if (sv == "pbs"sv) { id = ID::pbs; }
-        else if (sv == "cw"sv) { id = ID::cw; }
-        else if (sv == "ion"sv) { id = ID::ion; }
-        else if (sv == "mnt"sv) { id = ID::mnt; }
-        else { throw runtime_error( "unknown channel: " + string(sv) ); }
+    void apply(const Update update) {
+        switch (update.field) {
+            case Field::ssim_index: set_unique( update.field, ssim_index_, bits_to_float(update.value) ); break;
+            case Field::delivery_rate: set_unique( update.field, delivery_rate_, update.value ); break;
+            case Field::expt_id: set_unique( update.field, expt_id_, update.value ); break;
+            case Field::init_id: set_unique( update.field, init_id_, update.value ); break;
+            case Field::first_init_id: set_unique( update.field, first_init_id_, update.value ); break;
+            case Field::user_id: set_unique( update.field, user_id_, update.value ); break;
+            case Field::size: set_unique( update.field, size_, update.value ); break;
+            case Field::none: break;
+        }
     }
 
-    constexpr Channel(const uint8_t id_int) : id(static_cast<ID>(id_int)) {}
+    /* Overwrite field, whether or not already set (e.g. to renumber an id) */
+    void replace(const Update update) {
+        present_.clear(update.field);
+        apply(update);
+    }
 
-    operator string_view() const { return names[uint8_t(id)]; }
-    constexpr operator uint8_t() const { return static_cast<uint8_t>(id); }
+    /* Set the fields set in later -- the record with the same timestamp, from later in the export --
+     * as if later's updates had been applied to this one (see TimestampTable::spill) */
+    void merge(const VideoSent & later) {
+        auto merge_field = [&](const Field field, auto & member, const auto & later_member) {
+            if (later.present_.has(field)) {
+                set_unique(field, member, later_member);
+            }
+        };
+        merge_field(Field::ssim_index, ssim_index_, later.ssim_index_);
+        merge_field(Field::delivery_rate, delivery_rate_, later.delivery_rate_);
+        merge_field(Field::expt_id, expt_id_, later.expt_id_);
+        merge_field(Field::init_id, init_id_, later.init_id_);
+        merge_field(Field::first_init_id, first_init_id_, later.first_init_id_);
+        merge_field(Field::user_id, user_id_, later.user_id_);
+        merge_field(Field::size, size_, later.size_);
+        bad = bad or later.bad;
+    }
 
-    bool operator==(const Channel other) { return id == other.id; }
-    bool operator!=(const Channel other) { return not operator==(other); }
+    void insert_unique(const string_view key, const string_view value,
+            string_table & usernames ) {
+        apply(decode(key, value, usernames));
+    }
+    friend std::ostream& operator<<(std::ostream& out, const VideoSent& s); 
 };
+std::ostream& operator<< (std::ostream& out, const VideoSent& s) {        
+    return out << "init_id=" << s.init_id().value_or(-1)
+        << ", expt_id=" << s.expt_id().value_or(-1)
+        << ", user_id=" << s.user_id().value_or(-1)
+        << ", ssim_index=" << s.ssim_index().value_or(-1)
+        << ", delivery_rate=" << s.delivery_rate().value_or(-1)
+        << ", size=" << s.size().value_or(-1)
+        << ", first_init_id=" << s.first_init_id().value_or(-1)
+        << "\n";
+}
+static_assert(sizeof(VideoSent) <= 32, "VideoSent should stay packed");
 
 Channel get_channel(const vector<string_view> & fields) {
     for (const auto & field : fields) {
@@ -484,86 +765,572 @@ Channel get_channel(const vector<string_view> & fields) {
     throw runtime_error("channel missing");
 }
 
-using event_table = map<uint64_t, Event>;
-using sysinfo_table = map<uint64_t, Sysinfo>;
-using video_sent_table = map<uint64_t, VideoSent>;
-/* Whenever a timestamp is used to represent a day, round down to Influx backup hour.
- * Influx records ts as nanoseconds - use nanoseconds up until writing ts to stdout. */
-using Day_ns = uint64_t;
-/* I only want to type this once. */
-#define NS_PER_SEC 1000000000UL
+/* Records of one type (Event, Sysinfo, or VideoSent) for one server (and channel), keyed by timestamp.
+ * Parsing appends each field update to a flat buffer. Pending updates are sorted by timestamp
+ * (stably, so each record sees its updates in export order, as set_unique requires) and
+ * folded into a vector of records sorted by timestamp, whenever they outnumber the records
+ * (amortizing the merge) and at finalize().
+ * Timestamps are kept in a vector parallel to the records, so packed records aren't padded
+ * out to the alignment of a uint64_t.
+ * Iteration (in increasing ts order, yielding [ts, record&] pairs) is only allowed once finalized;
+ * alternatively, records can be drained (see drain_before) as parsing goes.
+ * To bound memory, the records so far can be spilled to a file (see spill), to be merged back
+ * in at finalize(). */
+template <class T>
+class TimestampTable {
+    static_assert(is_trivially_copyable_v<T>, "records are spilled as bytes");
+
+    struct PendingUpdate {
+        uint64_t ts;
+        typename T::Update update;
+    };
 
-#define MAX_SSIM 0.99999    // max acceptable raw SSIM (exclusive) 
-// ignore SSIM ~ 1
-optional<double> raw_ssim_to_db(const double raw_ssim) {
-    if (raw_ssim > MAX_SSIM) return nullopt; 
-    return -10.0 * log10( 1 - raw_ssim );
-}
+    /* Records written by spill: size timestamps at offset, then size records */
+    struct Run {
+        const SpillFile * file;
+        uint64_t offset;
+        size_t size;
+    };
 
-class Parser {
-    private:
-        string_table usernames{};
-        string_table browsers{};
-        string_table ostable{};
+    /* Reads a run back, a block at a time */
+    class RunReader {
+        constexpr static size_t BLOCK_RECORDS = 1 << 12;
+
+        Run run_;
+        size_t next_ = 0;                   // index in the run of the first record not yet read
+        vector<uint64_t> timestamps_{};
+        vector<T> records_{};
+        size_t pos_ = 0;                    // current record, in the block
+
+        void read_block() {
+            const size_t n = min(BLOCK_RECORDS, run_.size - next_);
+            timestamps_.resize(n);
+            records_.resize(n);
+            run_.file->read(run_.offset + next_ * sizeof(uint64_t), timestamps_.data(), n * sizeof(uint64_t));
+            run_.file->read(run_.offset + run_.size * sizeof(uint64_t) + next_ * sizeof(T),
+                             records_.data(), n * sizeof(T));
+            next_ += n;
+            pos_ = 0;
+        }
 
-        // client_buffer[server][channel] = map<ts, Event>
-        array<array<event_table, Channel::COUNT>, SERVER_COUNT> client_buffer{};
-        
-        // client_sysinfo[server] = map<ts, SysInfo>
-        array<sysinfo_table, SERVER_COUNT> client_sysinfo{};
-        
-        // video_sent[server][channel] = map<ts, VideoSent>
-        array<array<video_sent_table, Channel::COUNT>, SERVER_COUNT> video_sent{}; 
-        
-        // sessions[session_key] = vec<[ts, Event]>
-        // note channel is part of the key, so "sessions" represents the paper's notion of "streams"
-        using session_key = tuple<uint32_t, uint32_t, uint32_t, uint8_t, uint8_t>;
-        /*                        init_id,  uid,      expt_id,  server,  channel */
-        dense_hash_map<session_key, vector<pair<uint64_t, const Event*>>, boost::hash<session_key>> sessions;
+        public:
+        explicit RunReader(const Run & run) : run_(run) { read_block(); }
 
-        // sysinfos[sysinfo_key] = SysInfo
-        using sysinfo_key = tuple<uint32_t, uint32_t, uint32_t>;
-        /*                        init_id,  uid,      expt_id */
-        dense_hash_map<sysinfo_key, Sysinfo, boost::hash<sysinfo_key>> sysinfos;
+        bool done() const { return pos_ == records_.size(); }
+        uint64_t ts() const { return timestamps_[pos_]; }
+        const T & record() const { return records_[pos_]; }
 
-        // chunks[session_key] = vec<[ts, VideoSent]>
-        dense_hash_map<session_key, vector<pair<uint64_t, const VideoSent*>>, boost::hash<session_key>> chunks;
+        void advance() {
+            pos_++;
+            if (pos_ == records_.size() and next_ < run_.size) {
+                read_block();
+            }
+        }
+    };
 
-        unsigned int bad_count = 0;
+    template <class Record>
+    class Iterator {
+        const uint64_t * ts_;
+        Record * record_;
 
-        vector<string> experiments{};
+        public:
+        Iterator(const uint64_t * ts, Record * record) : ts_(ts), record_(record) {}
 
-        /* Timestamp range to be analyzed (influx export includes corrupt data outside the requested range).
-         * Any ts outside this range are rejected */
-        pair<Day_ns, Day_ns> days{};
-        size_t n_bad_ts = 0;
+        pair<uint64_t, Record &> operator*() const { return { *ts_, *record_ }; }
+        Iterator & operator++() { ts_++; record_++; return *this; }
+        bool operator!=(const Iterator & other) const { return ts_ != other.ts_; }
+    };
 
-        void read_experimental_settings_dump(const string & filename) {
-            ifstream experiment_dump{ filename };
-            if (not experiment_dump.is_open()) {
-                throw runtime_error( "can't open " + filename );
-            }
+    // don't bother compacting fewer pending updates than this
+    constexpr static size_t MIN_COMPACT = 1 << 12;
 
-            string line_storage;
+    vector<PendingUpdate> pending_{};
+    vector<uint64_t> timestamps_{};  // timestamps_[i] is the ts of records_[i]
+    vector<T> records_{};
+    vector<Run> runs_{};             // spilled records, each run later in the export than the one before
 
-            while (true) {
-                getline(experiment_dump, line_storage);
-                if (not experiment_dump.good()) {
-                    break;
-                }
+    void check_finalized() const {
+        if (not pending_.empty()) {
+            throw logic_error("TimestampTable used before finalize()");
+        }
+    }
 
-                const string_view line{line_storage};
+    /* Fold pending updates into records */
+    void compact() {
+        if (pending_.empty()) {
+            return;
+        }
 
-                const size_t separator = line.find_first_of(' ');
-                if (separator == line.npos) {
-                    throw runtime_error("can't find separator: " + line_storage);
-                }
-                const uint64_t experiment_id = to_uint64(line.substr(0, separator));
-                if (experiment_id > numeric_limits<uint16_t>::max()) {
-                    throw runtime_error("invalid expt_id: " + line_storage);
-                }
-                const string_view rest_of_string = line.substr(separator+1);
-                Json::Reader reader;
+        // export is usually sorted by timestamp within each field of each series
+        auto ts_less = [](const PendingUpdate & a, const PendingUpdate & b) { return a.ts < b.ts; };
+        if (not is_sorted(pending_.begin(), pending_.end(), ts_less)) {
+            stable_sort(pending_.begin(), pending_.end(), ts_less);
+        }
+
+        // apply each run of same-ts updates to the existing record at ts, or to a new one
+        const size_t n_existing = records_.size();
+        vector<uint64_t> new_timestamps;
+        vector<T> new_records;
+        size_t existing = 0;
+        for (size_t i = 0; i < pending_.size(); ) {
+            const uint64_t ts = pending_[i].ts;
+            while (existing < n_existing and timestamps_[existing] < ts) {
+                existing++;
+            }
+            T * record;
+            if (existing < n_existing and timestamps_[existing] == ts) {
+                record = &records_[existing];
+            } else {
+                new_timestamps.push_back(ts);
+                record = &new_records.emplace_back();
+            }
+            for (; i < pending_.size() and pending_[i].ts == ts; i++) {
+                record->apply(pending_[i].update);
+            }
+        }
+        pending_.clear();
+
+        if (new_records.empty()) {
+            return;
+        }
+        if (records_.empty()) {
+            timestamps_ = move(new_timestamps);
+            records_ = move(new_records);
+            return;
+        }
+        if (new_timestamps.front() > timestamps_.back()) {
+            // append-only
+            timestamps_.insert(timestamps_.end(), new_timestamps.begin(), new_timestamps.end());
+            records_.insert(records_.end(), new_records.begin(), new_records.end());
+            return;
+        }
+
+        // merge the two sorted runs (no ts is in both)
+        vector<uint64_t> merged_timestamps;
+        vector<T> merged_records;
+        merged_timestamps.reserve(n_existing + new_records.size());
+        merged_records.reserve(n_existing + new_records.size());
+        size_t from_new = 0;
+        existing = 0;
+        while (existing < n_existing or from_new < new_records.size()) {
+            if (from_new == new_records.size()
+                    or (existing < n_existing and timestamps_[existing] < new_timestamps[from_new])) {
+                merged_timestamps.push_back(timestamps_[existing]);
+                merged_records.push_back(records_[existing]);
+                existing++;
+            } else {
+                merged_timestamps.push_back(new_timestamps[from_new]);
+                merged_records.push_back(new_records[from_new]);
+                from_new++;
+            }
+        }
+        timestamps_ = move(merged_timestamps);
+        records_ = move(merged_records);
+    }
+
+    /* Merge the runs, then the records in memory (the latest), into records.
+     * Records with the same ts in several of them are merged in that order (see T::merge). */
+    void merge_runs() {
+        vector<RunReader> readers;
+        size_t n_records = records_.size();
+        for (const Run & run : runs_) {
+            readers.emplace_back(run);
+            n_records += run.size;
+        }
+        const size_t in_memory = readers.size();
+        size_t next_in_memory = 0;
+
+        // next ts of each source (readers, then in_memory) not yet merged; ties go to the earlier source
+        priority_queue<pair<uint64_t, size_t>, vector<pair<uint64_t, size_t>>, greater<>> heads;
+        for (size_t source = 0; source < readers.size(); source++) {
+            if (not readers[source].done()) {
+                heads.emplace(readers[source].ts(), source);
+            }
+        }
+        if (not records_.empty()) {
+            heads.emplace(timestamps_[0], in_memory);
+        }
+
+        vector<uint64_t> merged_timestamps;
+        vector<T> merged_records;
+        merged_timestamps.reserve(n_records);
+        merged_records.reserve(n_records);
+        while (not heads.empty()) {
+            const auto [ts, source] = heads.top();
+            heads.pop();
+
+            const T & record = source == in_memory ? records_[next_in_memory] : readers[source].record();
+            if (not merged_timestamps.empty() and merged_timestamps.back() == ts) {
+                merged_records.back().merge(record);
+            } else {
+                merged_timestamps.push_back(ts);
+                merged_records.push_back(record);
+            }
+
+            if (source == in_memory) {
+                if (++next_in_memory < records_.size()) {
+                    heads.emplace(timestamps_[next_in_memory], in_memory);
+                }
+            } else {
+                readers[source].advance();
+                if (not readers[source].done()) {
+                    heads.emplace(readers[source].ts(), source);
+                }
+            }
+        }
+        merged_timestamps.shrink_to_fit();
+        merged_records.shrink_to_fit();
+        timestamps_ = move(merged_timestamps);
+        records_ = move(merged_records);
+        runs_.clear();
+    }
+
+    public:
+    void insert(const uint64_t ts, const typename T::Update update) {
+        pending_.push_back({ts, update});
+        if (pending_.size() >= max(MIN_COMPACT, records_.size())) {
+            compact();
+        }
+    }
+
+    /* Fold in all pending updates (and any spilled records), and release the pending buffer */
+    void finalize() {
+        compact();
+        if (not runs_.empty()) {
+            merge_runs();
+        }
+        pending_.shrink_to_fit();
+    }
+
+    /* Fold in pending updates, and move all records to the end of file, freeing their memory;
+     * finalize() reads them back. Returns the bytes written. */
+    size_t spill(SpillFile & file) {
+        compact();
+        size_t written = 0;
+        if (not records_.empty()) {
+            const size_t n = records_.size();
+            const uint64_t offset = file.append(timestamps_.data(), n * sizeof(uint64_t));
+            file.append(records_.data(), n * sizeof(T));
+            runs_.push_back({&file, offset, n});
+            written = n * (sizeof(uint64_t) + sizeof(T));
+        }
+        pending_ = {};
+        timestamps_ = {};
+        records_ = {};
+        return written;
+    }
+
+    /* Bytes of memory held (including spare capacity) */
+    size_t memory() const {
+        return pending_.capacity() * sizeof(PendingUpdate) + timestamps_.capacity() * sizeof(uint64_t)
+            + records_.capacity() * sizeof(T);
+    }
+
+    /* Fold in pending updates, then remove each record with timestamp < ts, passing it to
+     * f(ts, record) in increasing ts order. Any later insert must have timestamp >= ts. */
+    template <class F>
+    void drain_before(const uint64_t ts, F && f) {
+        if (not runs_.empty()) {
+            throw logic_error("TimestampTable drained after spill()");
+        }
+        if (pending_.empty() and records_.empty()) {
+            return;
+        }
+        compact();
+        const size_t n = lower_bound(timestamps_.begin(), timestamps_.end(), ts) - timestamps_.begin();
+        for (size_t i = 0; i < n; i++) {
+            f(timestamps_[i], records_[i]);
+        }
+        timestamps_.erase(timestamps_.begin(), timestamps_.begin() + n);
+        records_.erase(records_.begin(), records_.begin() + n);
+    }
+
+    /* Remove all records, keeping the storage for reuse */
+    void clear() {
+        pending_.clear();
+        timestamps_.clear();
+        records_.clear();
+        runs_.clear();
+    }
+
+    size_t size() const { check_finalized(); return records_.size(); }
+
+    Iterator<T> begin() { check_finalized(); return { timestamps_.data(), records_.data() }; }
+    Iterator<T> end() { check_finalized(); return { timestamps_.data() + size(), records_.data() + size() }; }
+    Iterator<const T> begin() const { check_finalized(); return { timestamps_.data(), records_.data() }; }
+    Iterator<const T> end() const { check_finalized(); return { timestamps_.data() + size(), records_.data() + size() }; }
+};
+
+using event_table = TimestampTable<Event>;
+using sysinfo_table = TimestampTable<Sysinfo>;
+using video_sent_table = TimestampTable<VideoSent>;
+/* Whenever a timestamp is used to represent a day, round down to Influx backup hour.
+ * Influx records ts as nanoseconds - use nanoseconds up until writing ts to stdout. */
+using Day_ns = uint64_t;
+/* I only want to type this once. */
+#define NS_PER_SEC 1000000000UL
+
+#define MAX_SSIM 0.99999    // max acceptable raw SSIM (exclusive) 
+// ignore SSIM ~ 1
+optional<double> raw_ssim_to_db(const double raw_ssim) {
+    if (raw_ssim > MAX_SSIM) return nullopt; 
+    return -10.0 * log10( 1 - raw_ssim );
+}
+
+/* Bounded queue between two threads.
+ * push() and pop() return false once the queue is closed (pop() first drains what's left). */
+template <typename T>
+class BlockingQueue {
+    mutex mutex_{};
+    condition_variable not_empty_{};
+    condition_variable not_full_{};
+    deque<T> items_{};
+    size_t capacity_;
+    bool closed_ = false;
+
+    public:
+    explicit BlockingQueue(const size_t capacity) : capacity_(capacity) {}
+
+    bool push(T && item) {
+        unique_lock<mutex> lock{mutex_};
+        not_full_.wait(lock, [&] { return closed_ or items_.size() < capacity_; });
+        if (closed_) {
+            return false;
+        }
+        items_.push_back(move(item));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    bool pop(T & item) {
+        unique_lock<mutex> lock{mutex_};
+        not_empty_.wait(lock, [&] { return closed_ or not items_.empty(); });
+        if (items_.empty()) {
+            return false;
+        }
+        item = move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    void close() {
+        lock_guard<mutex> lock{mutex_};
+        closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+};
+
+/* Hash map split into SHARDS dense_hash_maps by the high bits of each key's hash (dense_hash_map
+ * buckets by the low bits), so threads can fill different shards at once without locking */
+template <class Key, class Value, class Hash>
+class ShardedMap {
+    public:
+    constexpr static unsigned int SHARD_BITS = 6;
+    constexpr static size_t SHARDS = 1 << SHARD_BITS;
+    using Shard = dense_hash_map<Key, Value, Hash>;
+
+    private:
+    array<Shard, SHARDS> shards_{};
+
+    public:
+    explicit ShardedMap(const Key & empty_key) {
+        for (Shard & shard : shards_) {
+            shard.set_empty_key(empty_key);
+        }
+    }
+
+    static size_t shard_index(const Key & key) {
+        return (uint64_t(Hash{}(key)) * 0x9e3779b97f4a7c15) >> (64 - SHARD_BITS);
+    }
+
+    Shard & shard(const size_t index) { return shards_[index]; }
+    const Shard & shard(const size_t index) const { return shards_[index]; }
+    Shard & shard_for(const Key & key) { return shards_[shard_index(key)]; }
+
+    /* Value of key, or nullptr if none */
+    const Value * find(const Key & key) const {
+        const Shard & shard = shards_[shard_index(key)];
+        const auto it = shard.find(key);
+        return it == shard.end() ? nullptr : &it->second;
+    }
+
+    /* Remove all entries, keeping each shard's buckets for reuse */
+    void clear() {
+        for (Shard & shard : shards_) {
+            shard.clear_no_resize();
+        }
+    }
+
+    /* Call f(key, value) for every entry, shard by shard */
+    template <class F>
+    void for_each(F && f) const {
+        for (const Shard & shard : shards_) {
+            for (const auto & [key, value] : shard) {
+                f(key, value);
+            }
+        }
+    }
+};
+
+/* Lines of influx export copied out of the reader's buffer, for one parse worker */
+struct LineBatch {
+    string text{};                      // newline-terminated lines
+    vector<unsigned int> line_nos{};    // line number of each line in text
+};
+
+class Parser {
+    friend class ParserBench;   // bench_analyze.cc times summarize and video_summarize
+
+    private:
+        string_table usernames{};
+        string_table browsers{};
+        string_table ostable{};
+
+        // client_buffer[server][channel] = table<ts, Event>
+        array<array<event_table, Channel::COUNT>, SERVER_COUNT> client_buffer{};
+        
+        // client_sysinfo[server] = table<ts, SysInfo>
+        array<sysinfo_table, SERVER_COUNT> client_sysinfo{};
+        
+        // video_sent[server][channel] = table<ts, VideoSent>
+        array<array<video_sent_table, Channel::COUNT>, SERVER_COUNT> video_sent{}; 
+        
+        // back the arrays in sessions and chunks (one per grouping thread), all freed at once
+        // with the Parser, or reset for the next day
+        deque<Arena> arenas{};
+
+        // sessions[session_key] = array<[ts, Event]>
+        // note channel is part of the key, so "sessions" represents the paper's notion of "streams"
+        using session_key = tuple<uint32_t, uint32_t, uint32_t, uint8_t, uint8_t>;
+        /*                        init_id,  uid,      expt_id,  server,  channel */
+        template <class Record>
+        using stream_map = ShardedMap<session_key, Span<pair<uint64_t, const Record*>>, boost::hash<session_key>>;
+        stream_map<Event> sessions;
+
+        // sysinfos[sysinfo_key] = SysInfo
+        using sysinfo_key = tuple<uint32_t, uint32_t, uint32_t>;
+        /*                        init_id,  uid,      expt_id */
+        ShardedMap<sysinfo_key, Sysinfo, boost::hash<sysinfo_key>> sysinfos;
+
+        // sysinfo_init_ids[{uid, expt_id}] = init_ids of the sysinfos with that user and experiment, sorted
+        // (see find_sysinfo)
+        using user_expt_key = tuple<uint32_t, uint32_t>;
+        dense_hash_map<user_expt_key, vector<uint32_t>, boost::hash<user_expt_key>> sysinfo_init_ids;
+
+        // chunks[session_key] = array<[ts, VideoSent]>
+        stream_map<VideoSent> chunks;
+
+        // counted by grouping threads at once
+        atomic<unsigned int> bad_count = 0;
+
+        vector<string> experiments{};
+
+        /* Timestamp range to be analyzed (influx export includes corrupt data outside the requested range).
+         * Any ts outside this range are rejected */
+        pair<Day_ns, Day_ns> days{};
+        size_t n_bad_ts = 0;
+
+        // lines (and bytes, including newlines) of each ignored measurement, rejected by prefilter
+        array<size_t, measurements.size()> n_skipped_lines{}, n_skipped_bytes{};
+
+        // lines of export read (and bytes, including newlines), and lines of each measurement (see prefilter)
+        size_t n_lines_read = 0, n_bytes_read = 0;
+        array<size_t, measurements.size()> n_measurement_lines{};
+
+        /* --memory-budget: bytes of per-server tables the parse may hold (0 for no limit), beyond
+         * which tables are spilled to files in spill_dir; and bytes spilled */
+        size_t memory_budget = 0;
+        string spill_dir{};
+        size_t n_spilled_bytes = 0;
+
+        /* --memory-budget: a parse worker's accounting of its servers' tables (see note_inserts) */
+        struct SpillState {
+            size_t budget = 0;              // bytes of tables the worker may hold; 0 for no limit
+            unique_ptr<SpillFile> file{};   // created at the first spill
+            // inserts so far, and at each server's latest insert (0: the worker hasn't inserted into it)
+            uint64_t n_inserts = 0;
+            array<uint64_t, SERVER_COUNT> last_insert{};
+            uint64_t next_check = 0;
+            size_t spilled_bytes = 0;
+        };
+
+        /* State touched by parse_line, besides the per-server tables.
+         * Each parse worker has its own, so workers share nothing on the insert path. */
+        struct ParseState {
+            string_table usernames{};
+            string_table browsers{};
+            string_table ostable{};
+            size_t n_bad_ts = 0;
+            // scratch for split_on_char
+            vector<string_view> fields{}, measurement_tag_set_fields{}, field_key_value{};
+            // scratch for parse_tsm
+            tsm::Block block{};
+            SpillState spill{};
+
+            ParseState() {
+                usernames.forward_map_vivify("unknown");
+                browsers.forward_map_vivify("unknown");
+                ostable.forward_map_vivify("unknown");
+            }
+        };
+
+        // --memory-budget: inserts by a worker between checks of its tables' memory
+        constexpr static uint64_t BUDGET_CHECK_INSERTS = 1 << 16;
+
+        // parallel parse: batches of lines in flight per worker, and size of each
+        constexpr static unsigned int BATCHES_PER_WORKER = 8;
+        constexpr static size_t LINE_BATCH_BYTES = 1 << 20;
+
+        // streams of older sessions (without first_init_id) find their session's sysinfo up to this
+        // many init_ids below their own
+        constexpr static uint32_t MAX_CHANNEL_CHANGES = 1023;
+
+        // seconds between consecutive events, beyond which a stream is truncated (see summarize)
+        constexpr static double MAX_EVENT_INTERVAL = 8.0;
+
+        /* --stream: export time between drains of complete records from the tables, and
+         * default export time without records after which a stream is finalized. Any later event
+         * is past MAX_EVENT_INTERVAL, but batch mode would still count it in the stream's extent
+         * (and label the stream trunc), so the default leaves room for streams that pause briefly
+         * (the streams in bench/export.txt come out as in batch mode from 12 s up) */
+        constexpr static uint64_t STREAM_DRAIN_INTERVAL = NS_PER_SEC;
+        constexpr static unsigned int DEFAULT_IDLE_TIMEOUT = 60;
+
+        /* --stream: records of a stream not yet finalized (copied out of the tables, which are drained) */
+        struct ActiveStream {
+            vector<pair<uint64_t, Event>> events{};
+            vector<pair<uint64_t, VideoSent>> chunks{};
+            uint64_t last_ts = 0;
+        };
+
+        void read_experimental_settings_dump(const string & filename) {
+            ifstream experiment_dump{ filename };
+            if (not experiment_dump.is_open()) {
+                throw runtime_error( "can't open " + filename );
+            }
+
+            string line_storage;
+
+            while (true) {
+                getline(experiment_dump, line_storage);
+                if (not experiment_dump.good()) {
+                    break;
+                }
+
+                const string_view line{line_storage};
+
+                const size_t separator = line.find_first_of(' ');
+                if (separator == line.npos) {
+                    throw runtime_error("can't find separator: " + line_storage);
+                }
+                const uint64_t experiment_id = to_uint64(line.substr(0, separator));
+                if (experiment_id > numeric_limits<uint16_t>::max()) {
+                    throw runtime_error("invalid expt_id: " + line_storage);
+                }
+                const string_view rest_of_string = line.substr(separator+1);
+                Json::Reader reader;
                 Json::Value doc;
                 reader.parse(string(rest_of_string), doc);
                 experiments.resize(experiment_id + 1);
@@ -576,227 +1343,1054 @@ class Parser {
             }
         }
 
+        /* Does analyze store lines of this measurement? (See parse_line) */
+        static bool is_stored(const Measurement measurement) {
+            return measurement == Measurement::client_buffer
+                or measurement == Measurement::client_sysinfo
+                or measurement == Measurement::video_sent;
+        }
+
+        /* Timestamp of a line (the digits after its last ' '), if it has one */
+        static optional<uint64_t> line_timestamp(const string_view line) {
+            const size_t timestamp_start = line.rfind(' ') + 1;
+            uint64_t timestamp;
+            if (timestamp_start == 0 or not parse_digits(line.substr(timestamp_start), timestamp)) {
+                return nullopt;
+            }
+            return timestamp;
+        }
+
+        /* Cheap first pass over a line, before splitting it: find its measurement (the text up to
+         * the first ',' or ' ') and timestamp (after the last ' '), and reject the line if the
+         * timestamp is out of range (counted in n_bad_ts) or the measurement isn't stored
+         * (counted per measurement).
+         * Returns whether to parse_line the line; lines this can't classify are passed on,
+         * so parse_line handles them as it always has. */
+        bool prefilter(const string_view line) {
+            n_lines_read++;
+            n_bytes_read += line.size() + 1;
+            if (line.empty() or line.front() == '#') {
+                return false;
+            }
+            if (line.size() > numeric_limits<uint8_t>::max()) {
+                return true;    // parse_line throws
+            }
+
+            const optional<Measurement> measurement = measurements.lookup(line.substr(0, line.find_first_of(", ")));
+            if (not measurement) {
+                return true;
+            }
+            n_measurement_lines[uint8_t(*measurement)]++;
+
+            const optional<uint64_t> timestamp = line_timestamp(line);
+            if (not timestamp) {
+                return true;
+            }
+
+            if (*timestamp < days.first or *timestamp > days.second) {
+                n_bad_ts++;
+                return false;
+            }
+            if (not is_stored(*measurement)) {
+                n_skipped_lines[uint8_t(*measurement)]++;
+                n_skipped_bytes[uint8_t(*measurement)] += line.size() + 1;
+                return false;
+            }
+            return true;
+        }
+
+        void print_skipped() const {
+            for (uint8_t m = 0; m < measurements.size(); m++) {
+                if (n_skipped_lines[m] > 0) {
+                    cerr << "skipped " << measurements.name(Measurement(m)) << ": " << n_skipped_lines[m]
+                         << " lines, " << n_skipped_bytes[m] << " bytes\n";
+                }
+            }
+        }
+
+        /* Parse one line of influxDB export, for lines measuring client_buffer, client_sysinfo, or video_sent.
+         * Each such line contains one field in an Event, SysInfo, or VideoSent (respectively)
+         * corresponding to a certain server, channel (for Event/VideoSent only), and timestamp.
+         * Store that field in the appropriate Event, SysInfo, or VideoSent (which may already
+         * be partially populated by other lines) in client_buffer, client_sysinfo, or video_sent.
+         * Ignore data points out of the date range.
+         * Only touches the tables of the line's server, and the given state. */
+        void parse_line(const string_view line, const unsigned int line_no, ParseState & state) {
+            auto & [usernames, browsers, ostable, n_bad_ts, fields, measurement_tag_set_fields, field_key_value, block, spill] = state;
+
+            if (line.empty() or line.front() == '#') {
+                return;
+            }
+
+            if (line.size() > numeric_limits<uint8_t>::max()) {
+                throw runtime_error("Line " + to_string(line_no) + " too long");
+            }
+
+            // influxDB export line has 3 space-separated fields
+            // e.g. client_buffer,channel=abc,server_id=1 cum_rebuf=2.183 1546379215825000000
+            split_on_char(line, ' ', fields);
+            if (fields.size() != 3) {
+                if (not line.compare(0, 15, "CREATE DATABASE"sv)) {
+                    return;
+                }
+
+                cerr << "Ignoring line with wrong number of fields: " << string(line) << "\n";
+                return;
+            }
+            const auto [measurement_tag_set, field_set, timestamp_str] = tie(fields[0], fields[1], fields[2]);
+            // e.g. ["client_buffer,channel=abc,server_id=1", "cum_rebuf=2.183", "1546379215825000000"]
+
+            // skip out-of-range data points
+            const uint64_t timestamp{to_uint64(timestamp_str)};
+            if (timestamp < days.first or timestamp > days.second) {
+                n_bad_ts++;
+                return;
+            }
+
+            split_on_char(measurement_tag_set, ',', measurement_tag_set_fields);
+            if (measurement_tag_set_fields.empty()) {
+                throw runtime_error("No measurement field on line " + to_string(line_no));
+            }
+            const auto measurement = measurement_tag_set_fields[0]; // e.g. client_buffer
+
+            split_on_char(field_set, '=', field_key_value);
+            if (field_key_value.size() != 2) {
+                throw runtime_error("Irregular number of fields in field set: " + string(line));
+            }
+
+            const auto [key, value] = tie(field_key_value[0], field_key_value[1]);  // e.g. [cum_rebuf, 2.183]
+
+            try {
+                const optional<Measurement> measurement_id = measurements.lookup(measurement);
+                if (not measurement_id) {
+                    throw runtime_error( "Can't parse: " + string(line) );
+                }
+                switch (*measurement_id) {
+                    case Measurement::client_buffer: {
+                        // Set this line's field (e.g. cum_rebuf) in the Event corresponding to this
+                        // server, channel, and ts
+                        const auto server_id = get_server_id(measurement_tag_set_fields);
+                        const auto channel = get_channel(measurement_tag_set_fields);
+
+                        client_buffer[server_id][channel].insert(timestamp, Event::decode(key, value, usernames));
+                        note_inserts(server_id, 1, state);
+                        break;
+                    }
+                    case Measurement::client_sysinfo: {
+                        // some records in 2019-09-08T11_2019-09-09T11 have a crazy server_id and
+                        // seemingly the older record structure (with user= as part of the tags)
+                        optional<uint64_t> server_id;
+                        try {
+                            server_id.emplace(get_server_id(measurement_tag_set_fields));
+                        } catch (const exception & e) {
+                            cerr << "Error with server_id: " << e.what() << "\n";
+                        }
+
+                        // Set this line's field (e.g. browser) in the SysInfo corresponding to this
+                        // server and ts
+                        if (server_id.has_value()) {
+                            client_sysinfo[server_id.value()].insert(timestamp, Sysinfo::decode(key, value, usernames, browsers, ostable));
+                            note_inserts(server_id.value(), 1, state);
+                        }
+                        break;
+                    }
+                    case Measurement::video_sent: {
+                        // Set this line's field (e.g. ssim_index) in the VideoSent corresponding to this
+                        // server, channel, and ts
+                        const auto server_id = get_server_id(measurement_tag_set_fields);
+                        const auto channel = get_channel(measurement_tag_set_fields);
+                        video_sent[server_id][channel].insert(timestamp, VideoSent::decode(key, value, usernames));
+                        note_inserts(server_id, 1, state);
+                        break;
+                    }
+                    case Measurement::video_acked:
+                        //		video_acked[get_server_id(measurement_tag_set_fields)][timestamp].insert_unique(key, value);
+                        break;
+                    case Measurement::active_streams:
+                    case Measurement::backlog:
+                    case Measurement::channel_status:
+                    case Measurement::client_error:
+                    case Measurement::decoder_info:
+                    case Measurement::server_info:
+                    case Measurement::ssim:
+                    case Measurement::video_size:
+                        // skip
+                        break;
+                }
+            } catch (const exception & e ) {
+                cerr << "Failure on line: " << line << "\n";
+                throw;
+            }
+        }
+
+        /* Worker owning every server with server % n_workers == its index.
+         * Receives only its servers' lines (plus lines without a usable server_id),
+         * so it can insert into their tables without locks. */
+        struct ParseWorker {
+            ParseState state{};
+            BlockingQueue<LineBatch> full{BATCHES_PER_WORKER};     // splitter => worker
+            BlockingQueue<LineBatch> empty{BATCHES_PER_WORKER};    // worker => splitter, for reuse
+            exception_ptr error{};
+            thread worker_thread{};
+        };
+
+        void parse_worker(ParseWorker & worker, const unsigned int index, const unsigned int n_workers) {
+            try {
+                LineBatch batch;
+                while (worker.full.pop(batch)) {
+                    size_t line_start = 0;
+                    for (const unsigned int line_no : batch.line_nos) {
+                        const size_t line_end = batch.text.find('\n', line_start);
+                        parse_line({batch.text.data() + line_start, line_end - line_start}, line_no, worker.state);
+                        line_start = line_end + 1;
+                    }
+                    batch.text.clear();
+                    batch.line_nos.clear();
+                    worker.empty.push(move(batch));
+                }
+                finalize_tables(index, n_workers);
+            } catch (...) {
+                worker.error = current_exception();
+                // unblock the splitter, which then stops reading
+                worker.full.close();
+                worker.empty.close();
+            }
+        }
+
+        /* Server that owns this line, from its tag set, without splitting the whole line.
+         * Matches get_server_id for lines with a valid server_id; nullopt otherwise
+         * (such lines never reach the tables: parse_line skips them or throws first).
+         * A tag set with quotes is split the same (quote-aware) way parse_line splits it,
+         * using the scratch vectors. */
+        static optional<uint8_t> route_server_id(const string_view line,
+                                                 vector<string_view> & fields,
+                                                 vector<string_view> & measurement_tag_set_fields) {
+            optional<uint8_t> server_id;
+            auto check_tag = [&server_id](const string_view tag) {
+                if (not tag.compare(0, 10, "server_id="sv)) {
+                    uint64_t id = 0;
+                    const auto [ptr, ec] = from_chars(tag.data() + 10, tag.data() + tag.size(), id);
+                    if (ec != errc() or ptr != tag.data() + tag.size() or id == 0 or id > SERVER_COUNT) {
+                        server_id.reset();
+                    } else {
+                        server_id = id - 1;
+                    }
+                }
+            };
+
+            const string_view measurement_tag_set = line.substr(0, line.find(' '));
+            if (measurement_tag_set.find('"') != string_view::npos) {
+                // quoted tags: spaces and commas may be inside quotes
+                split_on_char(line, ' ', fields);
+                if (fields.size() != 3) {
+                    return nullopt;
+                }
+                split_on_char(fields[0], ',', measurement_tag_set_fields);
+                for (const string_view tag : measurement_tag_set_fields) {
+                    check_tag(tag);
+                }
+                return server_id;
+            }
+
+            size_t tag_start = 0;
+            while (tag_start <= measurement_tag_set.size()) {
+                size_t tag_end = measurement_tag_set.find(',', tag_start);
+                if (tag_end == string_view::npos) {
+                    tag_end = measurement_tag_set.size();
+                }
+                check_tag(measurement_tag_set.substr(tag_start, tag_end - tag_start));
+                tag_start = tag_end + 1;
+            }
+            return server_id;
+        }
+
+        /* Bring names from each worker's string tables into the Parser's tables,
+         * and rewrite the ids stored in each worker's servers accordingly */
+        void merge_string_tables(vector<unique_ptr<ParseWorker>> & workers) {
+            const size_t n_workers = workers.size();
+            // id_maps[worker] = {usernames, browsers, ostable}, each worker id => Parser id
+            vector<array<vector<uint32_t>, 3>> id_maps(n_workers);
+            for (size_t w = 0; w < n_workers; w++) {
+                ParseState & state = workers[w]->state;
+                for (uint32_t id = 0; id < state.usernames.size(); id++) {
+                    id_maps[w][0].push_back(usernames.forward_map_vivify(state.usernames.reverse_map(id)));
+                }
+                for (uint32_t id = 0; id < state.browsers.size(); id++) {
+                    id_maps[w][1].push_back(browsers.forward_map_vivify(state.browsers.reverse_map(id)));
+                }
+                for (uint32_t id = 0; id < state.ostable.size(); id++) {
+                    id_maps[w][2].push_back(ostable.forward_map_vivify(state.ostable.reverse_map(id)));
+                }
+            }
+
+            auto remap = [](auto & record, const auto field, const optional<uint32_t> id,
+                    const vector<uint32_t> & id_map) {
+                if (id.has_value()) {
+                    record.replace({field, id_map.at(id.value())});
+                }
+            };
+
+            vector<thread> threads;
+            for (size_t w = 0; w < n_workers; w++) {
+                threads.emplace_back([&, w] {
+                    const auto & [user_map, browser_map, os_map] = id_maps[w];
+                    for (size_t server = w; server < SERVER_COUNT; server += n_workers) {
+                        for (uint8_t channel = 0; channel < Channel::COUNT; channel++) {
+                            for (const auto & [ts, event] : client_buffer[server][channel]) {
+                                remap(event, Event::Field::user_id, event.user_id(), user_map);
+                            }
+                            for (const auto & [ts, videosent] : video_sent[server][channel]) {
+                                remap(videosent, VideoSent::Field::user_id, videosent.user_id(), user_map);
+                            }
+                        }
+                        for (const auto & [ts, sysinfo] : client_sysinfo[server]) {
+                            remap(sysinfo, Sysinfo::Field::user_id, sysinfo.user_id(), user_map);
+                            remap(sysinfo, Sysinfo::Field::browser_id, sysinfo.browser_id(), browser_map);
+                            remap(sysinfo, Sysinfo::Field::os, sysinfo.os(), os_map);
+                        }
+                    }
+                });
+            }
+            for (auto & t : threads) {
+                t.join();
+            }
+        }
+
+        /* Bytes held by the tables of server */
+        size_t server_memory(const size_t server) const {
+            size_t memory = client_sysinfo[server].memory();
+            for (uint8_t channel = 0; channel < Channel::COUNT; channel++) {
+                memory += client_buffer[server][channel].memory() + video_sent[server][channel].memory();
+            }
+            return memory;
+        }
+
+        /* Move the records of server's tables to file, until finalize_tables; returns the bytes written */
+        size_t spill_server(const size_t server, SpillFile & file) {
+            size_t written = client_sysinfo[server].spill(file);
+            for (uint8_t channel = 0; channel < Channel::COUNT; channel++) {
+                written += client_buffer[server][channel].spill(file);
+                written += video_sent[server][channel].spill(file);
+            }
+            return written;
+        }
+
+        /* Count n inserts into the tables of server, by the worker with state.
+         * With --memory-budget, every BUDGET_CHECK_INSERTS inserts, if the tables of the worker's
+         * servers take more than its budget, spill the least recently inserted-to of them until
+         * the rest fit in 3/4 of it (export is grouped by series, so those are likely done). */
+        void note_inserts(const uint8_t server, const size_t n, ParseState & state) {
+            SpillState & spill = state.spill;
+            if (spill.budget == 0) {
+                return;
+            }
+            spill.n_inserts += n;
+            spill.last_insert[server] = spill.n_inserts;
+            if (spill.n_inserts < spill.next_check) {
+                return;
+            }
+            spill.next_check = spill.n_inserts + BUDGET_CHECK_INSERTS;
+
+            vector<tuple<uint64_t, uint8_t, size_t>> servers;   // last insert, server, memory
+            size_t total = 0;
+            for (size_t s = 0; s < SERVER_COUNT; s++) {
+                if (spill.last_insert[s] > 0) {
+                    servers.emplace_back(spill.last_insert[s], s, server_memory(s));
+                    total += get<2>(servers.back());
+                }
+            }
+            if (total <= spill.budget) {
+                return;
+            }
+
+            sort(servers.begin(), servers.end());
+            for (const auto & [last_insert, s, memory] : servers) {
+                if (total <= spill.budget / 4 * 3) {
+                    break;
+                }
+                if (not spill.file) {
+                    spill.file = make_unique<SpillFile>(spill_dir);
+                }
+                const size_t written = spill_server(s, *spill.file);
+                spill.spilled_bytes += written;
+                total -= memory;
+                cerr << "spilled server " << int(s) << " (" << memory / (1024 * 1024) << " MiB in memory, "
+                     << written / (1024 * 1024) << " MiB to disk)\n";
+            }
+        }
+
+        /* Fold pending updates (and spilled records) into the tables of servers first_server, first_server + stride, ... */
+        void finalize_tables(const size_t first_server, const size_t stride) {
+            for (size_t server = first_server; server < SERVER_COUNT; server += stride) {
+                for (uint8_t channel = 0; channel < Channel::COUNT; channel++) {
+                    client_buffer[server][channel].finalize();
+                    video_sent[server][channel].finalize();
+                }
+                client_sysinfo[server].finalize();
+            }
+        }
+
+        /* Parse state for parsing on one thread, starting from the Parser's string tables
+         * (so names interned on earlier days keep their ids), which adopt_state takes back */
+        ParseState lend_state() {
+            ParseState state;
+            state.usernames = move(usernames);
+            state.browsers = move(browsers);
+            state.ostable = move(ostable);
+            state.spill.budget = memory_budget;
+            return state;
+        }
+
+        /* Take the string tables and counts of the only parse state */
+        void adopt_state(ParseState & state) {
+            // state's tables were lent by the Parser, or seeded like its tables, so ids carry over unchanged
+            usernames = move(state.usernames);
+            browsers = move(state.browsers);
+            ostable = move(state.ostable);
+            n_bad_ts += state.n_bad_ts;
+            n_spilled_bytes += state.spill.spilled_bytes;
+        }
+
+        /* TSM files of the puffer database in an influx backup's data directory,
+         * in the order influx_inspect export reads them */
+        static vector<string> tsm_filenames(const string & datadir) {
+            const string shards = datadir + "/puffer/retention32d/*/";
+            glob_t tombstones{}, files{};
+            glob((shards + "*.tombstone").c_str(), 0, nullptr, &tombstones);
+            const size_t n_tombstones = tombstones.gl_pathc;
+            globfree(&tombstones);
+            if (n_tombstones > 0) {
+                // deletes aren't applied to the TSM files until compaction
+                throw runtime_error("TSM tombstone files (deleted data) are not supported; found in " + shards);
+            }
+
+            glob((shards + "*.tsm").c_str(), 0, nullptr, &files);
+            vector<string> ret(files.gl_pathv, files.gl_pathv + files.gl_pathc);
+            globfree(&files);
+            if (ret.empty()) {
+                throw runtime_error("no TSM files in " + shards);
+            }
+            return ret;
+        }
+
+        /* Insert the points of one series (one field of a measurement, on a server and channel)
+         * into table, decoding each value with decode. Blocks entirely outside the date range
+         * only have their timestamps decoded, to count them in n_bad_ts. Returns the points inserted. */
+        template <class Table, class Decode>
+        size_t read_tsm_series(const tsm::File & file, const vector<tsm::BlockEntry> & entries,
+                Table & table, Decode && decode, ParseState & state) const {
+            tsm::Block & block = state.block;
+            size_t n_inserted = 0;
+            for (const tsm::BlockEntry & entry : entries) {
+                // TSM timestamps are signed
+                if (int64_t(entry.max_time) < int64_t(days.first) or int64_t(entry.min_time) > int64_t(days.second)) {
+                    file.read_timestamps(entry, block.timestamps);
+                    state.n_bad_ts += block.timestamps.size();
+                    continue;
+                }
+                file.read_block(entry, block);
+                for (size_t i = 0; i < block.size(); i++) {
+                    const uint64_t timestamp = block.timestamps[i];
+                    if (timestamp < days.first or timestamp > days.second) {
+                        state.n_bad_ts++;
+                        continue;
+                    }
+                    table.insert(timestamp, decode(block.value(i)));
+                    n_inserted++;
+                }
+            }
+            return n_inserted;
+        }
+
+        /* Read the series stored by analyze (see is_stored) from each TSM file, for the servers
+         * with server % n_workers == index. Series of fields that aren't stored (Field::none)
+         * aren't read at all. Only touches the tables of those servers, and the given state. */
+        void read_tsm_files(const vector<unique_ptr<tsm::File>> & files, const unsigned int index,
+                const unsigned int n_workers, ParseState & state) {
+            auto & tags = state.measurement_tag_set_fields;
+
+            for (const auto & file : files) {
+                // series being read: set by wanted, for read
+                Measurement measurement{};
+                uint8_t field = 0, server_id = 0, channel = 0;
+
+                // e.g. client_buffer,channel=abc,server_id=1#!~#cum_rebuf
+                auto wanted = [&](const string_view key) {
+                    const size_t separator = key.find("#!~#"sv);
+                    if (separator == string_view::npos) {
+                        throw runtime_error("TSM key without field: " + string(key));
+                    }
+                    const string_view field_key = key.substr(separator + 4);
+                    split_on_char(key.substr(0, separator), ',', tags);
+
+                    const optional<Measurement> measurement_id = measurements.lookup(tags[0]);
+                    if (not measurement_id) {
+                        throw runtime_error("Can't parse TSM key: " + string(key));
+                    }
+                    measurement = *measurement_id;
+
+                    // field keys are checked as parse_line would, but unstored fields are skipped
+                    auto lookup_field = [&](const auto & fields) {
+                        const auto found = fields.lookup(field_key);
+                        if (not found) {
+                            throw runtime_error( "unknown key: " + string(field_key) );
+                        }
+                        field = uint8_t(*found);
+                        return *found;
+                    };
+                    switch (measurement) {
+                        case Measurement::client_buffer:
+                            if (lookup_field(event_fields) == Event::Field::none) {
+                                return false;
+                            }
+                            break;
+                        case Measurement::client_sysinfo:
+                            if (lookup_field(sysinfo_fields) == Sysinfo::Field::none) {
+                                return false;
+                            }
+                            // see parse_line; reported once, by the first worker
+                            try {
+                                server_id = get_server_id(tags);
+                            } catch (const exception & e) {
+                                if (index == 0) {
+                                    cerr << "Error with server_id: " << e.what() << "\n";
+                                }
+                                return false;
+                            }
+                            return server_id % n_workers == index;
+                        case Measurement::video_sent:
+                            if (lookup_field(video_sent_fields) == VideoSent::Field::none) {
+                                return false;
+                            }
+                            break;
+                        default:
+                            return false;
+                    }
+                    server_id = get_server_id(tags);
+                    channel = get_channel(tags);
+                    return server_id % n_workers == index;
+                };
+
+                auto read = [&](const string_view key, const tsm::BlockType, const vector<tsm::BlockEntry> & entries) {
+                    try {
+                        size_t n_inserted;
+                        switch (measurement) {
+                            case Measurement::client_buffer:
+                                n_inserted = read_tsm_series(*file, entries, client_buffer[server_id][channel], [&](const tsm::Value & value) {
+                                    return Event::decode(Event::Field(field), value, state.usernames);
+                                }, state);
+                                break;
+                            case Measurement::client_sysinfo:
+                                n_inserted = read_tsm_series(*file, entries, client_sysinfo[server_id], [&](const tsm::Value & value) {
+                                    return Sysinfo::decode(Sysinfo::Field(field), value,
+                                                           state.usernames, state.browsers, state.ostable);
+                                }, state);
+                                break;
+                            case Measurement::video_sent:
+                                n_inserted = read_tsm_series(*file, entries, video_sent[server_id][channel], [&](const tsm::Value & value) {
+                                    return VideoSent::decode(VideoSent::Field(field), value, state.usernames);
+                                }, state);
+                                break;
+                            default:
+                                throw logic_error("reading unstored measurement");
+                        }
+                        note_inserts(server_id, n_inserted, state);
+                    } catch (const exception & e) {
+                        cerr << "Failure on series: " << key << " in " << file->filename() << "\n";
+                        throw;
+                    }
+                };
+
+                file->for_each_key(wanted, read);
+            }
+        }
+
+        static void print_progress(const unsigned int line_no) {
+            if (line_no % 1000000 == 0) {
+                const size_t rss = memcheck() / 1024;
+                cerr << "line " << line_no / 1000000 << "M, RSS=" << rss << " MiB\n";
+            }
+        }
+
     public:
         Parser(const string & experiment_dump_filename, Day_ns start_ts)
-            : sessions(), sysinfos(), chunks()
+            : sessions({0,0,0,-1,-1}), sysinfos({0,0,0}), sysinfo_init_ids(), chunks({0,0,0,-1,-1})
         {
-            sessions.set_empty_key({0,0,0,-1,-1});
-            sysinfos.set_empty_key({0,0,0});
-            chunks.set_empty_key({0,0,0,-1,-1});
-
+            sysinfo_init_ids.set_empty_key({-1,-1});
             usernames.forward_map_vivify("unknown");
             browsers.forward_map_vivify("unknown");
             ostable.forward_map_vivify("unknown");
 
             read_experimental_settings_dump(experiment_dump_filename);
+            start_day(start_ts);
+        }
+
+        /* Forget the records of any earlier day, and analyze the day starting at start_ts next.
+         * Experiments and string tables are kept, and tables, maps, and arenas keep their storage. */
+        void start_day(const Day_ns start_ts) {
             days.first = start_ts;
             days.second = start_ts + 60 * 60 * 24 * NS_PER_SEC;
+            n_bad_ts = 0;
+            n_skipped_lines = {};
+            n_skipped_bytes = {};
+            n_lines_read = n_bytes_read = 0;
+            n_measurement_lines = {};
+            n_spilled_bytes = 0;
+            bad_count = 0;
+
+            for (size_t server = 0; server < SERVER_COUNT; server++) {
+                for (uint8_t channel = 0; channel < Channel::COUNT; channel++) {
+                    client_buffer[server][channel].clear();
+                    video_sent[server][channel].clear();
+                }
+                client_sysinfo[server].clear();
+            }
+            sessions.clear();
+            sysinfos.clear();
+            sysinfo_init_ids.clear_no_resize();
+            chunks.clear();
+            for (Arena & arena : arenas) {
+                arena.reset();
+            }
         }
 
+        /* Keep the tables parsed within budget bytes (0 for no limit), by spilling them to files in dir */
+        void set_memory_budget(const size_t budget, const string & dir) {
+            memory_budget = budget;
+            spill_dir = dir;
+        }
 
-        /* Parse lines of influxDB export, for lines measuring client_buffer, client_sysinfo, or video_sent.
-         * Each such line contains one field in an Event, SysInfo, or VideoSent (respectively)
-         * corresponding to a certain server, channel (for Event/VideoSent only), and timestamp.
-         * Store that field in the appropriate Event, SysInfo, or VideoSent (which may already
-         * be partially populated by other lines) in client_buffer, client_sysinfo, or video_sent. 
-         * Ignore data points out of the date range. */
-        void parse_stdin() {
-            ios::sync_with_stdio(false);
-            string line_storage;
+        size_t lines_read() const { return n_lines_read; }
+        size_t bytes_read() const { return n_bytes_read; }
 
+        /* Add the day's input and data-quality counts to the metrics record */
+        void count_metrics() const {
+            Metrics & metrics = Metrics::get();
+            for (uint8_t m = 0; m < measurements.size(); m++) {
+                if (n_measurement_lines[m] > 0) {
+                    metrics.count("lines." + string(measurements.name(Measurement(m))), n_measurement_lines[m]);
+                }
+            }
+            metrics.count("lines", n_lines_read);
+            metrics.count("bytes", n_bytes_read);
+            metrics.count("bad_records", bad_count);
+            metrics.count("out_of_range_ts", n_bad_ts);
+            metrics.count("spilled_bytes", n_spilled_bytes);
+        }
+
+        /* Parse all lines of influxDB export on this thread (see prefilter and parse_line).
+         * Lines are views into the reader's buffer (no per-line copy). */
+        void parse_stdin(LineReader & reader) {
             unsigned int line_no = 0;
+            ParseState state = lend_state();
+            string_view line;
 
-            vector<string_view> fields, measurement_tag_set_fields, field_key_value;
+            while (true) {
+                print_progress(line_no);
 
-            while (cin.good()) {
-                if (line_no % 1000000 == 0) {
-                    const size_t rss = memcheck() / 1024;
-                    cerr << "line " << line_no / 1000000 << "M, RSS=" << rss << " MiB\n"; 
+                if (not reader.get_line(line)) {
+                    break;
                 }
-
-                getline(cin, line_storage);
                 line_no++;
 
-                const string_view line{line_storage};
+                if (prefilter(line)) {
+                    parse_line(line, line_no, state);
+                }
+            }
+            finalize_tables(0, 1);
+            print_skipped();
+            adopt_state(state);
+        }
 
-                if (line.empty() or line.front() == '#') {
-                    continue;
+        /* Parse influxDB export with n_workers threads (see parse_line).
+         * This thread reads and prefilters lines, and routes each to the worker owning its server_id
+         * (see route_server_id); lines without a usable server_id never reach the tables,
+         * so they are spread round-robin.
+         * Exceptions from a worker stop the read and are rethrown here. */
+        void parse_stdin_parallel(LineReader & reader, const unsigned int n_workers) {
+            vector<unique_ptr<ParseWorker>> workers;
+            for (unsigned int w = 0; w < n_workers; w++) {
+                workers.emplace_back(make_unique<ParseWorker>());
+                workers.back()->state.spill.budget = memory_budget / n_workers;
+                for (unsigned int i = 0; i < BATCHES_PER_WORKER - 1; i++) {
+                    workers.back()->empty.push({});
                 }
+            }
+            for (unsigned int w = 0; w < n_workers; w++) {
+                workers[w]->worker_thread = thread([this, &workers, w, n_workers] { parse_worker(*workers[w], w, n_workers); });
+            }
+
+            // batch currently being filled for each worker
+            vector<LineBatch> filling(n_workers);
+            bool stopped = false;
 
-                if (line.size() > numeric_limits<uint8_t>::max()) {
-                    throw runtime_error("Line " + to_string(line_no) + " too long");
+            auto send = [&](const unsigned int w) {
+                if (not workers[w]->full.push(move(filling[w])) or not workers[w]->empty.pop(filling[w])) {
+                    stopped = true;     // worker failed
                 }
+            };
 
-                // influxDB export line has 3 space-separated fields
-                // e.g. client_buffer,channel=abc,server_id=1 cum_rebuf=2.183 1546379215825000000
-                split_on_char(line, ' ', fields);
-                if (fields.size() != 3) {
-                    if (not line.compare(0, 15, "CREATE DATABASE"sv)) {
-                        continue;
-                    }
+            unsigned int line_no = 0;
+            unsigned int next_unrouted = 0;
+            string_view line;
+            vector<string_view> fields, measurement_tag_set_fields;     // scratch for route_server_id
 
-                    cerr << "Ignoring line with wrong number of fields: " << string(line) << "\n";
-                    continue;
+            while (not stopped) {
+                print_progress(line_no);
+
+                if (not reader.get_line(line)) {
+                    break;
                 }
-                const auto [measurement_tag_set, field_set, timestamp_str] = tie(fields[0], fields[1], fields[2]);
-                // e.g. ["client_buffer,channel=abc,server_id=1", "cum_rebuf=2.183", "1546379215825000000"]
+                line_no++;
 
-                // skip out-of-range data points
-                const uint64_t timestamp{to_uint64(timestamp_str)};
-                if (timestamp < days.first or timestamp > days.second) {
-                    n_bad_ts++;
+                if (not prefilter(line)) {
                     continue;
                 }
 
-                split_on_char(measurement_tag_set, ',', measurement_tag_set_fields);
-                if (measurement_tag_set_fields.empty()) {
-                    throw runtime_error("No measurement field on line " + to_string(line_no));
+                unsigned int w;
+                const optional<uint8_t> server_id = route_server_id(line, fields, measurement_tag_set_fields);
+                if (server_id.has_value()) {
+                    w = server_id.value() % n_workers;
+                } else {
+                    w = next_unrouted;
+                    next_unrouted = (next_unrouted + 1) % n_workers;
                 }
-                const auto measurement = measurement_tag_set_fields[0]; // e.g. client_buffer
 
-                split_on_char(field_set, '=', field_key_value);          
-                if (field_key_value.size() != 2) {
-                    throw runtime_error("Irregular number of fields in field set: " + string(line));
+                LineBatch & batch = filling[w];
+                batch.text.append(line);
+                batch.text.push_back('\n');
+                batch.line_nos.push_back(line_no);
+                if (batch.text.size() >= LINE_BATCH_BYTES) {
+                    send(w);
                 }
+            }
 
-                const auto [key, value] = tie(field_key_value[0], field_key_value[1]);  // e.g. [cum_rebuf, 2.183]
+            for (unsigned int w = 0; w < n_workers and not stopped; w++) {
+                if (not filling[w].line_nos.empty()) {
+                    send(w);
+                }
+            }
+            for (auto & worker : workers) {
+                worker->full.close();
+            }
+            for (auto & worker : workers) {
+                worker->worker_thread.join();
+            }
+            for (auto & worker : workers) {
+                if (worker->error) {
+                    rethrow_exception(worker->error);
+                }
+            }
 
-                try {
-                    if ( measurement == "client_buffer"sv ) {
-                        // Set this line's field (e.g. cum_rebuf) in the Event corresponding to this 
-                        // server, channel, and ts 
-                        const auto server_id = get_server_id(measurement_tag_set_fields);
-                        const auto channel = get_channel(measurement_tag_set_fields);
+            merge_string_tables(workers);
+            for (const auto & worker : workers) {
+                n_bad_ts += worker->state.n_bad_ts;
+                n_spilled_bytes += worker->state.spill.spilled_bytes;
+            }
+            print_skipped();
+        }
+
+        /* Read an influx backup's TSM files directly (see read_tsm_files), instead of parsing
+         * the text of influx_inspect export, which must decode them all the same.
+         * With n_workers > 1, each thread reads the servers it owns, as in parse_stdin_parallel
+         * (every thread scans each file's index, but decodes only its own series).
+         * Points are inserted in the order export would print them (file by file, then key by key),
+         * so records come out the same as from the export, except:
+         *  - unstored fields don't create records (a point with only those would make an incomplete one)
+         *  - string values are as stored, where export text escapes their quotes and backslashes
+         *  - out_of_range_ts only counts points of stored series */
+        void parse_tsm(const string & datadir, const unsigned int n_workers) {
+            vector<unique_ptr<tsm::File>> files;
+            for (const string & filename : tsm_filenames(datadir)) {
+                files.emplace_back(make_unique<tsm::File>(filename));
+            }
+
+            if (n_workers == 1) {
+                ParseState state = lend_state();
+                read_tsm_files(files, 0, 1, state);
+                finalize_tables(0, 1);
+                adopt_state(state);
+                return;
+            }
+
+            vector<unique_ptr<ParseWorker>> workers;
+            for (unsigned int w = 0; w < n_workers; w++) {
+                workers.emplace_back(make_unique<ParseWorker>());
+                workers.back()->state.spill.budget = memory_budget / n_workers;
+            }
+            for (unsigned int w = 0; w < n_workers; w++) {
+                workers[w]->worker_thread = thread([this, &files, &workers, w, n_workers] {
+                    ParseWorker & worker = *workers[w];
+                    try {
+                        read_tsm_files(files, w, n_workers, worker.state);
+                        finalize_tables(w, n_workers);
+                    } catch (...) {
+                        worker.error = current_exception();
+                    }
+                });
+            }
+            for (auto & worker : workers) {
+                worker->worker_thread.join();
+            }
+            for (auto & worker : workers) {
+                if (worker->error) {
+                    rethrow_exception(worker->error);
+                }
+            }
+
+            merge_string_tables(workers);
+            for (const auto & worker : workers) {
+                n_bad_ts += worker->state.n_bad_ts;
+                n_spilled_bytes += worker->state.spill.spilled_bytes;
+            }
+        }
+
+        /* Count and skip "bad" records (a field was set multiple times); throw for "incomplete" ones
+         * (a field was never set). what names the record type in the exception. */
+        template <class Record>
+        bool usable(const Record & record, const uint64_t ts, const char * what) {
+            if (record.bad) {
+                const unsigned int n_bad = ++bad_count;
+                cerr << "Skipping bad data point (of " + to_string(n_bad) + " total) with contradictory values.\n";
+                return false;
+            }
+            if (not record.complete()) {
+                throw runtime_error("incomplete "s + what + " with timestamp " + to_string(ts));
+            }
+            return true;
+        }
+
+        /* Store a usable Sysinfo in sysinfos, checking it agrees with any already stored for its key.
+         * Only touches the key's shard, so threads may add Sysinfos of different shards at once.
+         * Returns whether the key is new (and so not yet in sysinfo_init_ids). */
+        bool add_sysinfo(const Sysinfo & sysinfo) {
+            const sysinfo_key key{*sysinfo.init_id(), *sysinfo.user_id(), *sysinfo.expt_id()};
+            auto & shard = sysinfos.shard_for(key);
+            const auto it = shard.find(key);
+            if (it == shard.end()) {
+                shard[key] = sysinfo;
+                return true;
+            }
+            if (it->second != sysinfo) {
+                throw runtime_error("contradictory sysinfo for " + to_string(*sysinfo.init_id()));
+            }
+            return false;
+        }
+
+        /* Add a key new to sysinfos to sysinfo_init_ids, keeping its init_ids sorted */
+        void index_sysinfo(const sysinfo_key & key) {
+            const auto & [init_id, uid, expt_id] = key;
+            vector<uint32_t> & init_ids = sysinfo_init_ids[{uid, expt_id}];
+            init_ids.insert(upper_bound(init_ids.begin(), init_ids.end(), init_id), init_id);
+        }
+
+        /* Index all of sysinfos, once complete */
+        void index_sysinfos() {
+            sysinfos.for_each([&](const sysinfo_key & key, const Sysinfo &) {
+                const auto & [init_id, uid, expt_id] = key;
+                sysinfo_init_ids[{uid, expt_id}].push_back(init_id);
+            });
+            for (auto & [user_expt, init_ids] : sysinfo_init_ids) {
+                sort(init_ids.begin(), init_ids.end());
+            }
+        }
+
+        /* Sysinfo of the session with the largest init_id at most MAX_CHANNEL_CHANGES below init_id
+         * (wrapping around below 0), for the same user and experiment, and how far below it is;
+         * nullptr if none. */
+        pair<const Sysinfo *, int> find_sysinfo(const uint32_t init_id, const uint32_t uid, const uint32_t expt_id) const {
+            const auto it = sysinfo_init_ids.find({uid, expt_id});
+            if (it == sysinfo_init_ids.end()) {
+                return { nullptr, -1 };
+            }
+            const vector<uint32_t> & init_ids = it->second;
+            const auto above = upper_bound(init_ids.begin(), init_ids.end(), init_id);
+            // nearest at or below init_id, else (if init_id is small) the largest, reached by wrapping
+            const uint32_t nearest = above == init_ids.begin() ? init_ids.back() : *(above - 1);
+            const uint32_t decrement = init_id - nearest;
+            if (decrement > MAX_CHANNEL_CHANGES) {
+                return { nullptr, -1 };
+            }
+            return { sysinfos.find({nearest, uid, expt_id}), decrement };
+        }
+
+        /* Run f(w) for w in [0, n_workers), each on its own thread (or this one, if n_workers is 1),
+         * and rethrow the first worker's exception, if any */
+        template <class F>
+        static void run_workers(const unsigned int n_workers, F && f) {
+            if (n_workers == 1) {
+                f(0);
+                return;
+            }
+            vector<exception_ptr> errors(n_workers);
+            vector<thread> threads;
+            for (unsigned int w = 0; w < n_workers; w++) {
+                threads.emplace_back([&, w] {
+                    try {
+                        f(w);
+                    } catch (...) {
+                        errors[w] = current_exception();
+                    }
+                });
+            }
+            for (auto & t : threads) {
+                t.join();
+            }
+            for (const auto & error : errors) {
+                if (error) {
+                    rethrow_exception(error);
+                }
+            }
+        }
+
+        static void print_server_progress(const char * what, const size_t server) {
+            const size_t rss = memcheck() / 1024;
+            cerr << what + "_server "s + to_string(server) + "/" + to_string(SERVER_COUNT) + ", RSS=" + to_string(rss) + " MiB\n";
+        }
+
+        /* Scratch for group_by_stream, reused from table to table */
+        template <class Record>
+        struct StreamGrouping {
+            dense_hash_map<session_key, uint32_t, boost::hash<session_key>> ids{};  // key => index in streams
+            vector<pair<session_key, Span<pair<uint64_t, const Record*>>>> streams{};
+            vector<tuple<uint32_t, uint64_t, const Record*>> records{};             // stream index, ts, record
+
+            StreamGrouping() { ids.set_empty_key({0,0,0,-1,-1}); }
+        };
+
+        /* Streams grouped by one thread, bucketed by the shard of the stream map they go in */
+        template <class Record>
+        using grouped_streams = array<vector<pair<session_key, Span<pair<uint64_t, const Record*>>>>,
+                                      stream_map<Record>::SHARDS>;
+
+        /* Add the usable records of table (one server's and channel's) to grouped, by stream key.
+         * A stream's records all come from one table, so its array is allocated once, exactly sized:
+         * the first pass counts each stream's records (indexing the table's streams locally), the
+         * second fills the arrays from arena, in increasing ts order. */
+        template <class Record>
+        void group_by_stream(const TimestampTable<Record> & table, const uint8_t server, const uint8_t channel,
+                grouped_streams<Record> & grouped, StreamGrouping<Record> & grouping, Arena & arena,
+                const char * what) {
+            using Entry = pair<uint64_t, const Record*>;
+            if (table.size() == 0) {
+                return;
+            }
+            grouping.ids.clear();
+            grouping.streams.clear();
+            grouping.records.clear();
+            for (const auto & [ts, record] : table) {
+                if (not usable(record, ts, what)) {
+                    continue;
+                }
+                const session_key key{*record.init_id(), *record.user_id(), *record.expt_id(), server, channel};
+                const auto [it, inserted] = grouping.ids.insert({key, grouping.streams.size()});
+                if (inserted) {
+                    grouping.streams.emplace_back(key, Span<Entry>{});
+                }
+                Span<Entry> & stream = grouping.streams[it->second].second;
+                stream = {nullptr, stream.size() + 1};
+                grouping.records.emplace_back(it->second, ts, &record);
+            }
+
+            for (auto & [key, stream] : grouping.streams) {
+                stream = {arena.allocate<Entry>(stream.size()), 0};
+            }
+            for (const auto & [index, ts, record] : grouping.records) {
+                Span<Entry> & stream = grouping.streams[index].second;
+                new (stream.end()) Entry(ts, record);
+                stream = {stream.data(), stream.size() + 1};
+            }
+            for (const auto & stream : grouping.streams) {
+                grouped[stream_map<Record>::shard_index(stream.first)].push_back(stream);
+            }
+        }
 
-                        client_buffer[server_id][channel][timestamp].insert_unique(key, value, usernames);
-                    } else if ( measurement == "active_streams"sv ) {
-                        // skip
-                    } else if ( measurement == "backlog"sv ) {
-                        // skip
-                    } else if ( measurement == "channel_status"sv ) {
-                        // skip
-                    } else if ( measurement == "client_error"sv ) {
-                        // skip
-                    } else if ( measurement == "client_sysinfo"sv ) {
-                        // some records in 2019-09-08T11_2019-09-09T11 have a crazy server_id and
-                        // seemingly the older record structure (with user= as part of the tags)
-                        optional<uint64_t> server_id;
-                        try {
-                            server_id.emplace(get_server_id(measurement_tag_set_fields));
-                        } catch (const exception & e) {
-                            cerr << "Error with server_id: " << e.what() << "\n";
-                        }
+        /* Group the records of tables by stream, into streams, with n_workers threads.
+         * Each thread first groups the tables of its servers (as sharded by the parse), then fills
+         * its shards of streams from every thread's groups; a stream's records are all on one
+         * server, so a stream is only ever grouped by one thread, and nothing needs merging. */
+        template <class Record>
+        void accumulate_streams(const array<array<TimestampTable<Record>, Channel::COUNT>, SERVER_COUNT> & tables,
+                stream_map<Record> & streams, const unsigned int n_workers, const char * what) {
+            vector<grouped_streams<Record>> grouped(n_workers);
+            while (arenas.size() < n_workers) {
+                arenas.emplace_back();
+            }
 
-                        // Set this line's field (e.g. browser) in the SysInfo corresponding to this 
-                        // server and ts
-                        if (server_id.has_value()) {
-                            client_sysinfo[server_id.value()][timestamp].insert_unique(key, value, usernames, browsers, ostable);
-                        }
-                    } else if ( measurement == "decoder_info"sv ) {
-                        // skip
-                    } else if ( measurement == "server_info"sv ) {
-                        // skip
-                    } else if ( measurement == "ssim"sv ) {
-                        // skip
-                    } else if ( measurement == "video_acked"sv ) {
-                        //		video_acked[get_server_id(measurement_tag_set_fields)][timestamp].insert_unique(key, value);
-                    } else if ( measurement == "video_sent"sv ) {
-                        // Set this line's field (e.g. ssim_index) in the VideoSent corresponding to this 
-                        // server, channel, and ts
-                        const auto server_id = get_server_id(measurement_tag_set_fields);
-                        const auto channel = get_channel(measurement_tag_set_fields);
-                        video_sent[server_id][channel][timestamp].insert_unique(key, value, usernames);
-                    } else if ( measurement == "video_size"sv ) {
-                        // skip
-                    } else {
-                        throw runtime_error( "Can't parse: " + string(line) );
+            run_workers(n_workers, [&](const unsigned int w) {
+                StreamGrouping<Record> grouping;
+                for (size_t server = w; server < SERVER_COUNT; server += n_workers) {
+                    print_server_progress(what, server);
+                    for (uint8_t channel = 0; channel < Channel::COUNT; channel++) {
+                        group_by_stream(tables[server][channel], server, channel, grouped[w], grouping,
+                                        arenas[w], what);
                     }
-                } catch (const exception & e ) {
-                    cerr << "Failure on line: " << line << "\n";
-                    throw;
                 }
-            }
+            });
+
+            run_workers(n_workers, [&](const unsigned int w) {
+                for (size_t index = w; index < streams.SHARDS; index += n_workers) {
+                    auto & shard = streams.shard(index);
+                    size_t n_streams = shard.size();
+                    for (const auto & worker_grouped : grouped) {
+                        n_streams += worker_grouped[index].size();
+                    }
+                    shard.resize(n_streams);
+                    for (const auto & worker_grouped : grouped) {
+                        shard.insert(worker_grouped[index].begin(), worker_grouped[index].end());
+                    }
+                }
+            });
         }
 
         /* Group Events by stream (key is {init_id, expt_id, user_id, server, channel}) 
          * Ignore "bad" Events (field was set multiple times), throw for "incomplete" Events (field was never set)
          * Store in sessions, along with timestamp for each Event, ordered by increasing timestamp */
-        void accumulate_sessions() {
-            for (uint8_t server = 0; server < client_buffer.size(); server++) {
-                const size_t rss = memcheck() / 1024;
-                cerr << "session_server " << int(server) << "/" << client_buffer.size() << ", RSS=" << rss << " MiB\n";
-                for (uint8_t channel = 0; channel < Channel::COUNT; channel++) {
-                    // iterates in increasing ts order
-                    for (const auto & [ts,event] : client_buffer[server][channel]) {
-                        if (event.bad) {
-                            bad_count++;
-                            cerr << "Skipping bad data point (of " << bad_count << " total) with contradictory values.\n";
-                            continue;
-                        }
-                        if (not event.complete()) {
-                            throw runtime_error("incomplete event with timestamp " + to_string(ts));
-                        }
-
-                        sessions[{*event.init_id, *event.user_id, *event.expt_id, server, channel}].emplace_back(ts, &event);
-                    }
-                }
-            }
+        void accumulate_sessions(const unsigned int n_workers = 1) {
+            accumulate_streams(client_buffer, sessions, n_workers, "session");
         }
 
         /* Map each SysInfo to a stream or session (in the case of older data, when sysinfo was only supplied on load).
          * Key is {init_id, expt_id, user_id}.
          * Ignore "bad" SysInfos (field was set multiple times), throw for "incomplete" SysInfos (field was never set)
          * Store in sysinfos.
-         * Use init_id in the key, not first_init_id, since there may be multiple sysinfos per session. */
-        void accumulate_sysinfos() {
-            for (uint8_t server = 0; server < client_buffer.size(); server++) {
-                const size_t rss = memcheck() / 1024;
-                cerr << "sysinfo_server " << int(server) << "/" << client_buffer.size() << ", RSS=" << rss << " MiB\n";
-                for (const auto & [ts,sysinfo] : client_sysinfo[server]) {
-                    if (sysinfo.bad) {
-                        bad_count++;
-                        cerr << "Skipping bad data point (of " << bad_count << " total) with contradictory values.\n";
-                        continue;
+         * Use init_id in the key, not first_init_id, since there may be multiple sysinfos per session.
+         * With n_workers threads: each collects the usable SysInfos of its servers by shard, then
+         * adds every thread's SysInfos of its shards to sysinfos (in server order, within each thread). */
+        void accumulate_sysinfos(const unsigned int n_workers = 1) {
+            using sysinfo_map = decltype(sysinfos);
+            vector<array<vector<const Sysinfo *>, sysinfo_map::SHARDS>> collected(n_workers);
+
+            run_workers(n_workers, [&](const unsigned int w) {
+                for (size_t server = w; server < SERVER_COUNT; server += n_workers) {
+                    print_server_progress("sysinfo", server);
+                    for (const auto & [ts,sysinfo] : client_sysinfo[server]) {
+                        if (not usable(sysinfo, ts, "sysinfo")) {
+                            continue;
+                        }
+                        const sysinfo_key key{*sysinfo.init_id(), *sysinfo.user_id(), *sysinfo.expt_id()};
+                        collected[w][sysinfo_map::shard_index(key)].push_back(&sysinfo);
                     }
-                    if (not sysinfo.complete()) {
-                        throw runtime_error("incomplete sysinfo with timestamp " + to_string(ts));
-                    } 
-
-                    const sysinfo_key key{*sysinfo.init_id, *sysinfo.user_id, *sysinfo.expt_id};
-                    const auto it = sysinfos.find(key);
-                    if (it == sysinfos.end()) {
-                        sysinfos[key] = sysinfo;
-                    } else {
-                        if (sysinfos[key] != sysinfo) {
-                            throw runtime_error("contradictory sysinfo for " + to_string(*sysinfo.init_id));
+                }
+            });
+
+            run_workers(n_workers, [&](const unsigned int w) {
+                for (size_t index = w; index < sysinfo_map::SHARDS; index += n_workers) {
+                    for (const auto & worker_collected : collected) {
+                        for (const Sysinfo * sysinfo : worker_collected[index]) {
+                            add_sysinfo(*sysinfo);
                         }
                     }
                 }
-            }
+            });
+            index_sysinfos();
         }
 
         /* Group VideoSents by stream (key is {init_id, expt_id, user_id, server, channel}) 
          * Ignore "bad" VideoSents (field was set multiple times), throw for "incomplete" VideoSents (field was never set)
          * Store in chunks, along with timestamp for each VideoSent */
-        void accumulate_video_sents() {
-            for (uint8_t server = 0; server < client_buffer.size(); server++) {
-                const size_t rss = memcheck() / 1024;
-                cerr << "video_sent_server " << int(server) << "/" << video_sent.size() << ", RSS=" << rss << " MiB\n";
-                for (uint8_t channel = 0; channel < Channel::COUNT; channel++) {
-                    for (const auto & [ts,videosent] : video_sent[server][channel]) {
-                        if (videosent.bad) {
-                            bad_count++;
-                            cerr << "Skipping bad data point (of " << bad_count << " total) with contradictory values.\n";
-                            continue;
-                        }
-                        if (not videosent.complete()) {
-                            throw runtime_error("incomplete videosent with timestamp " + to_string(ts));
-                        }
-
-                        chunks[{*videosent.init_id, *videosent.user_id, *videosent.expt_id, server, channel}].emplace_back(ts, &videosent);
-                    }
-                }
-            }
+        void accumulate_video_sents(const unsigned int n_workers = 1) {
+            accumulate_streams(video_sent, chunks, n_workers, "video_sent");
         }
 
         // print a tuple of any size, promoting uint8_t
@@ -827,27 +2421,27 @@ class Parser {
 
         void debug_print_grouped_data() {
             cerr << "sessions:" << endl;
-            for ( const auto & [key, events] : sessions ) {
+            sessions.for_each([&]( const auto & key, const auto & events ) {
                 cerr << "session key: "; 
                 print(key);
                 for ( const auto & [ts, event] : events ) {
                     cerr << ts << ", " << *event; 
                 }
-            }
+            });
             cerr << "sysinfos:" << endl;
-            for ( const auto & [key, sysinfo] : sysinfos ) {
+            sysinfos.for_each([&]( const auto & key, const auto & sysinfo ) {
                 cerr << "sysinfo key: "; 
                 print(key);
                 cerr << sysinfo; 
-            }
+            });
             cerr << "chunks:" << endl;
-            for ( const auto & [key, stream_chunks] : chunks ) {
+            chunks.for_each([&]( const auto & key, const auto & stream_chunks ) {
                 cerr << "session key: "; 
                 print(key);
                 for ( const auto & [ts, videosent] : stream_chunks ) {
                     cerr << ts << ", " << *videosent; 
                 }
-            }
+            });
         }
 
         /* Corresponds to a line of analyze output; summarizes a stream */
@@ -868,12 +2462,14 @@ class Parser {
             string bad_reason{};    
         };
 
-        /* Output a summary of each stream */
-        void analyze_sessions() const {
-            float total_time_after_startup=0;
-            float total_stall_time=0;
-            float total_extent=0;
+        /* Totals over the streams output so far, for the summary lines at the end of output */
+        struct AnalysisTotals {
+            // in microseconds: integer sums don't depend on the order (or threads) streams are added in
+            int64_t total_time_after_startup=0;
+            int64_t total_stall_time=0;
+            int64_t total_extent=0;
 
+            size_t num_sessions=0;
             unsigned int had_stall=0;
             unsigned int good_sessions=0;
             unsigned int good_and_full=0;
@@ -883,112 +2479,540 @@ class Parser {
 
             size_t overall_chunks = 0, overall_high_ssim_chunks = 0, overall_ssim_1_chunks = 0;
 
-            for ( auto & [key, events] : sessions ) {
-                /* Find Sysinfo corresponding to this stream. */
-                /* Client increments init_id with each channel change.
-                 * Before ~11/27/19: must decrement init_id until reaching the initial init_id
-                 * to find the corresponding Sysinfo. Also, sysinfo was only supplied on load.
-                 * After 11/27: Each data point is recorded with first_init_id and init_id.
-                 * Also, sysinfo is supplied on both load and channel change. */
-                auto sysinfo_it = sysinfos.end();
-                int channel_changes = -1;
-                // use first event to check if stream uses first_init_id
-                optional<uint32_t> first_init_id = events.front().second->first_init_id;
+            static int64_t to_us(const double seconds) { return llround(seconds * 1000000); }
+
+            void add(const AnalysisTotals & other) {
+                total_time_after_startup += other.total_time_after_startup;
+                total_stall_time += other.total_stall_time;
+                total_extent += other.total_extent;
+                num_sessions += other.num_sessions;
+                had_stall += other.had_stall;
+                good_sessions += other.good_sessions;
+                good_and_full += other.good_and_full;
+                missing_sysinfo += other.missing_sysinfo;
+                missing_video_stats += other.missing_video_stats;
+                overall_chunks += other.overall_chunks;
+                overall_high_ssim_chunks += other.overall_high_ssim_chunks;
+                overall_ssim_1_chunks += other.overall_ssim_1_chunks;
+            }
+        };
+
+        // analyze_sessions: streams summarized between writes of output
+        constexpr static size_t SUMMARY_BATCH_STREAMS = 1 << 16;
+
+        /* What analyze_stream summarizes for a stream */
+        struct StreamInputs {
+            const session_key * key;
+            const Span<pair<uint64_t, const Event*>> * events;
+            const Span<pair<uint64_t, const VideoSent*>> * chunks = nullptr;  // nullptr if none
+            pair<const Sysinfo *, int> sysinfo = { nullptr, -1 };               // see find_stream_sysinfo
+        };
+
+        /* Order of session_keys and sysinfo_keys for join_streams: by user and experiment,
+         * then init_id, so a stream's sysinfo is at or before it (then server and channel) */
+        static tuple<uint32_t, uint32_t, uint32_t, uint8_t, uint8_t> join_order(const session_key & key) {
+            const auto & [init_id, uid, expt_id, server, channel] = key;
+            return { uid, expt_id, init_id, server, channel };
+        }
+        static tuple<uint32_t, uint32_t, uint32_t> join_order(const sysinfo_key & key) {
+            const auto & [init_id, uid, expt_id] = key;
+            return { uid, expt_id, init_id };
+        }
+
+        /* Every stream with its chunks and sysinfo (as find_stream_sysinfo would find), found by one
+         * merge pass over sessions, chunks, and sysinfos each sorted by join_order, rather than by
+         * probing chunks and sysinfos for each stream.
+         * Streams are in join_order. The three sorts run on separate threads, given n_workers > 1. */
+        vector<StreamInputs> join_streams(const unsigned int n_workers) const {
+            using ChunkRun = pair<const session_key *, const Span<pair<uint64_t, const VideoSent*>> *>;
+            using SysinfoRun = pair<const sysinfo_key *, const Sysinfo *>;
+            vector<StreamInputs> streams;
+            vector<ChunkRun> chunk_run;
+            vector<SysinfoRun> sysinfo_run;
+
+            run_workers(min(n_workers, 3u), [&](const unsigned int w) {
+                for (unsigned int run = w; run < 3; run += min(n_workers, 3u)) {
+                    if (run == 0) {
+                        sessions.for_each([&](const session_key & key, const Span<pair<uint64_t, const Event*>> & events) {
+                            streams.push_back({&key, &events});
+                        });
+                        sort(streams.begin(), streams.end(), [](const StreamInputs & a, const StreamInputs & b) {
+                            return join_order(*a.key) < join_order(*b.key);
+                        });
+                    } else if (run == 1) {
+                        chunks.for_each([&](const session_key & key, const Span<pair<uint64_t, const VideoSent*>> & stream_chunks) {
+                            chunk_run.emplace_back(&key, &stream_chunks);
+                        });
+                        sort(chunk_run.begin(), chunk_run.end(), [](const ChunkRun & a, const ChunkRun & b) {
+                            return join_order(*a.first) < join_order(*b.first);
+                        });
+                    } else {
+                        sysinfos.for_each([&](const sysinfo_key & key, const Sysinfo & sysinfo) {
+                            sysinfo_run.emplace_back(&key, &sysinfo);
+                        });
+                        sort(sysinfo_run.begin(), sysinfo_run.end(), [](const SysinfoRun & a, const SysinfoRun & b) {
+                            return join_order(*a.first) < join_order(*b.first);
+                        });
+                    }
+                }
+            });
+
+            auto next_chunks = chunk_run.begin();
+            auto next_sysinfo = sysinfo_run.begin();    // first sysinfo after the current stream's init_id
+            for (StreamInputs & stream : streams) {
+                const auto & [init_id, uid, expt_id, server, channel] = *stream.key;
+                while (next_chunks != chunk_run.end() and join_order(*next_chunks->first) < join_order(*stream.key)) {
+                    ++next_chunks;
+                }
+                if (next_chunks != chunk_run.end() and *next_chunks->first == *stream.key) {
+                    stream.chunks = next_chunks->second;
+                }
+
+                const tuple<uint32_t, uint32_t, uint32_t> stream_order{uid, expt_id, init_id};
+                while (next_sysinfo != sysinfo_run.end() and join_order(*next_sysinfo->first) <= stream_order) {
+                    ++next_sysinfo;
+                }
+                // the sysinfo with the largest init_id at or below the stream's, for its user and experiment
+                const SysinfoRun * below = nullptr;
+                if (next_sysinfo != sysinfo_run.begin()) {
+                    const SysinfoRun & candidate = *(next_sysinfo - 1);
+                    if (get<1>(*candidate.first) == uid and get<2>(*candidate.first) == expt_id) {
+                        below = &candidate;
+                    }
+                }
+
+                const optional<uint32_t> first_init_id = stream.events->front().second->first_init_id();
                 if (first_init_id) {
-                    /* We introduced first_init_id at the same time we started sending client_sysinfo 
-                     * for every stream, so if a stream has the first_init_id field in its datapoints, 
-                     * then that stream should have its own sysinfo
-                     * (so no need to decrement to find the sysinfo) */
-                    sysinfo_it = sysinfos.find({get<0>(key),
-                            get<1>(key),
-                            get<2>(key)});
-                    channel_changes = get<0>(key) - first_init_id.value();
-                } else {
-                    for ( unsigned int decrement = 0; decrement < 1024; decrement++ ) {
-                        sysinfo_it = sysinfos.find({get<0>(key) - decrement,
-                                get<1>(key),
-                                get<2>(key)});
-                        if (sysinfo_it == sysinfos.end()) {
-                            // loop again
+                    if (below and get<0>(*below->first) == init_id) {
+                        stream.sysinfo = { below->second, init_id - first_init_id.value() };
+                    } else {
+                        stream.sysinfo = { nullptr, init_id - first_init_id.value() };
+                    }
+                } else if (below and init_id - get<0>(*below->first) <= MAX_CHANNEL_CHANGES) {
+                    stream.sysinfo = { below->second, init_id - get<0>(*below->first) };
+                } else if (init_id < MAX_CHANNEL_CHANGES) {
+                    // may wrap around below 0, to the largest init_ids
+                    stream.sysinfo = find_sysinfo(init_id, uid, expt_id);
+                }
+            }
+            return streams;
+        }
+
+        /* Output a summary of each stream, in order of base time (then init_id, and the rest of the key),
+         * with n_workers threads: as text to cout, or as rows added to store if not null (and then
+         * the summary lines go to cerr).
+         * Streams are summarized in batches: each thread formats a contiguous slice of the batch into
+         * its own buffer, and the buffers are written in order, so output doesn't depend on the
+         * threads' timing. Each thread keeps its own totals, added at the end; they're integers
+         * (see AnalysisTotals), so the totals don't depend on the number of threads either. */
+        void analyze_sessions(const unsigned int n_workers = 1, const bool sorted_join = false,
+                              summarystore::Writer * const store = nullptr) const {
+            vector<StreamInputs> streams = sorted_join ? join_streams(n_workers) : vector<StreamInputs>{};
+            if (not sorted_join) {
+                sessions.for_each([&]( const session_key & key, const Span<pair<uint64_t, const Event*>> & events ) {
+                    streams.push_back({&key, &events});
+                });
+            }
+            sort(streams.begin(), streams.end(), [](const StreamInputs & a, const StreamInputs & b) {
+                const uint64_t a_base = a.events->front().first, b_base = b.events->front().first;
+                return tie(a_base, *a.key) < tie(b_base, *b.key);
+            });
+
+            vector<AnalysisTotals> worker_totals(n_workers);
+            vector<ostringstream> outputs(n_workers);
+            vector<vector<summarystore::Row>> rows(n_workers);
+            for (size_t batch_start = 0; batch_start < streams.size(); batch_start += SUMMARY_BATCH_STREAMS) {
+                const size_t batch_end = min(streams.size(), batch_start + SUMMARY_BATCH_STREAMS);
+                const size_t slice = (batch_end - batch_start + n_workers - 1) / n_workers;
+                run_workers(n_workers, [&](const unsigned int w) {
+                    outputs[w].str({});
+                    rows[w].clear();
+                    const size_t end = min(batch_end, batch_start + (w + 1) * slice);
+                    for (size_t i = batch_start + w * slice; i < end; i++) {
+                        StreamInputs & stream = streams[i];
+                        if (not sorted_join) {
+                            stream.chunks = chunks.find(*stream.key);
+                            stream.sysinfo = find_stream_sysinfo(*stream.key, *stream.events);
+                        }
+                        summarystore::Row row = analyze_stream(*stream.key, *stream.events, stream.chunks,
+                                                               stream.sysinfo, ostable, worker_totals[w]);
+                        if (store) {
+                            rows[w].push_back(move(row));
                         } else {
-                            channel_changes = decrement;
-                            break;
+                            print_stream(row, outputs[w]);
+                        }
+                    }
+                });
+                for (unsigned int w = 0; w < n_workers; w++) {
+                    cout << outputs[w].str();
+                    if (store) {
+                        for (const summarystore::Row & row : rows[w]) {
+                            store->add(row);
                         }
                     }
                 }
+            }
 
-                Sysinfo sysinfo{};
-                sysinfo.os = 0;
-                sysinfo.ip = 0;
-                if (sysinfo_it == sysinfos.end()) {
-                    missing_sysinfo++;
-                } else {
-                    sysinfo = sysinfo_it->second;
+            AnalysisTotals totals;
+            for (const auto & t : worker_totals) {
+                totals.add(t);
+            }
+            print_totals(totals, store ? cerr : cout);
+        }
+
+        /* Find Sysinfo corresponding to a stream, given its events: the Sysinfo (nullptr if none),
+         * and the stream's channel changes since its session's first stream (-1 if unknown). */
+        pair<const Sysinfo *, int> find_stream_sysinfo(const session_key & key,
+                                                       const Span<pair<uint64_t, const Event*>> & events) const {
+            /* Client increments init_id with each channel change.
+             * Before ~11/27/19: must decrement init_id until reaching the initial init_id
+             * to find the corresponding Sysinfo. Also, sysinfo was only supplied on load.
+             * After 11/27: Each data point is recorded with first_init_id and init_id.
+             * Also, sysinfo is supplied on both load and channel change. */
+            const Sysinfo * found_sysinfo = nullptr;
+            int channel_changes = -1;
+            // use first event to check if stream uses first_init_id
+            optional<uint32_t> first_init_id = events.front().second->first_init_id();
+            if (first_init_id) {
+                /* We introduced first_init_id at the same time we started sending client_sysinfo 
+                 * for every stream, so if a stream has the first_init_id field in its datapoints, 
+                 * then that stream should have its own sysinfo
+                 * (so no need to decrement to find the sysinfo) */
+                found_sysinfo = sysinfos.find({get<0>(key),
+                        get<1>(key),
+                        get<2>(key)});
+                channel_changes = get<0>(key) - first_init_id.value();
+            } else {
+                // the nearest init_id at or below the stream's that has a sysinfo, within MAX_CHANNEL_CHANGES
+                tie(found_sysinfo, channel_changes) = find_sysinfo(get<0>(key), get<1>(key), get<2>(key));
+            }
+            return { found_sysinfo, channel_changes };
+        }
+
+        /* Summarize one stream, given its events (in increasing ts order), its chunks (nullptr if none)
+         * and its sysinfo (see find_stream_sysinfo), and add it to totals.
+         * os_names maps the ids in sysinfos to OS names. */
+        summarystore::Row analyze_stream(const session_key & key, const Span<pair<uint64_t, const Event*>> & events,
+                                         const Span<pair<uint64_t, const VideoSent *>> * chunk_stream,
+                                         const pair<const Sysinfo *, int> & stream_sysinfo,
+                                         const string_table & os_names, AnalysisTotals & totals) const {
+            auto & [total_time_after_startup, total_stall_time, total_extent, num_sessions, had_stall, good_sessions, good_and_full,
+                    missing_sysinfo, missing_video_stats, overall_chunks, overall_high_ssim_chunks, overall_ssim_1_chunks] = totals;
+            num_sessions++;
+            const auto & [found_sysinfo, channel_changes] = stream_sysinfo;
+
+            Sysinfo sysinfo{};
+            sysinfo.apply({Sysinfo::Field::os, 0});
+            sysinfo.apply({Sysinfo::Field::ip, 0});
+            if (not found_sysinfo) {
+                missing_sysinfo++;
+            } else {
+                sysinfo = *found_sysinfo;
+            }
+
+            const EventSummary summary = summarize(key, events);
+
+            /* find matching videosent stream */
+            const auto [normal_ssim_chunks, ssim_1_chunks, total_chunks, ssim_sum, mean_delivery_rate, average_bitrate, ssim_variation] = video_summarize(chunk_stream);
+            const double mean_ssim = ssim_sum == -1 ? -1 : ssim_sum / normal_ssim_chunks;
+            const size_t high_ssim_chunks = total_chunks - normal_ssim_chunks;
+
+            if (mean_delivery_rate < 0 ) {
+                missing_video_stats++;
+            } else {
+                overall_chunks += total_chunks;
+                overall_high_ssim_chunks += high_ssim_chunks;
+                overall_ssim_1_chunks += ssim_1_chunks;
+            }
+
+            summarystore::Row row;
+            // ts from influx export include nanoseconds -- truncate to seconds
+            row.ts = summary.base_time / 1000000000;
+            row.good = summary.valid;
+            row.full = summary.full_extent;
+            row.bad_reason = summary.bad_reason;
+            row.scheme = summary.scheme;
+            row.ip = sysinfo.ip().value();
+            row.os = os_names.reverse_map(sysinfo.os().value());
+            row.channel_changes = channel_changes;
+            row.init_id = summary.init_id;
+            row.extent = summary.time_extent;
+            // a stream with a single event has no extent
+            row.used_pct = summary.time_extent > 0 ? 100 * summary.time_at_last_play / summary.time_extent : 0;
+            row.mean_ssim = mean_ssim;
+            row.mean_delivery_rate = mean_delivery_rate;
+            row.average_bitrate = average_bitrate;
+            row.ssim_variation_db = ssim_variation;
+            row.startup_delay = summary.cum_rebuf_at_startup;
+            row.total_after_startup = summary.time_at_last_play - summary.time_at_startup;
+            row.stall_after_startup = summary.cum_rebuf_at_last_play - summary.cum_rebuf_at_startup;
+
+            total_extent += AnalysisTotals::to_us(summary.time_extent);
+
+            if (summary.valid) {    // valid = "good"
+                good_sessions++;
+                total_time_after_startup += AnalysisTotals::to_us(summary.time_at_last_play - summary.time_at_startup);
+                if (summary.cum_rebuf_at_last_play > summary.cum_rebuf_at_startup) {
+                    had_stall++;
+                    total_stall_time += AnalysisTotals::to_us(summary.cum_rebuf_at_last_play - summary.cum_rebuf_at_startup);
                 }
+                if (summary.full_extent) {
+                    good_and_full++;
+                }
+            }
+            return row;
+        }
+
+        /* Output a stream's summary to out as a line of text */
+        static void print_stream(const summarystore::Row & row, ostream & out) {
+            char ip[INET_ADDRSTRLEN];
+            const in_addr ip_addr{row.ip};
+            inet_ntop(AF_INET, &ip_addr, ip, sizeof(ip));
+
+            out << fixed;
+            out << row.ts << " " << (row.good ? "good " : "bad ") << (row.full ? "full " : "trunc " ) << row.bad_reason << " "
+                << row.scheme << " " << ip
+                << " " << row.os
+                << " " << row.channel_changes << " init=" << row.init_id << " extent=" << row.extent
+                << " used=" << row.used_pct << "%"
+                << " mean_ssim=" << row.mean_ssim
+                << " mean_delivery_rate=" << row.mean_delivery_rate
+                << " average_bitrate=" << row.average_bitrate
+                << " ssim_variation_db=" << row.ssim_variation_db
+                << " startup_delay=" << row.startup_delay
+                << " total_after_startup=" << row.total_after_startup
+                << " stall_after_startup=" << row.stall_after_startup
+                << "\n";
+        }
 
-                const EventSummary summary = summarize(key, events);
+        /* Output the summary lines, after all streams */
+        void print_totals(const AnalysisTotals & totals, ostream & out) const {
+            const auto & [total_time_after_startup, total_stall_time, total_extent, num_sessions, had_stall, good_sessions, good_and_full,
+                          missing_sysinfo, missing_video_stats, overall_chunks, overall_high_ssim_chunks, overall_ssim_1_chunks] = totals;
 
-                /* find matching videosent stream */
-                const auto [normal_ssim_chunks, ssim_1_chunks, total_chunks, ssim_sum, mean_delivery_rate, average_bitrate, ssim_variation] = video_summarize(key);
-                const double mean_ssim = ssim_sum == -1 ? -1 : ssim_sum / normal_ssim_chunks;
-                const size_t high_ssim_chunks = total_chunks - normal_ssim_chunks;
+            // mark summary lines with # so confinterval will ignore them
+            out << fixed;
+            out << "#num_sessions=" << num_sessions << " good=" << good_sessions << " good_and_full=" << good_and_full << " missing_sysinfo=" << missing_sysinfo << " missing_video_stats=" << missing_video_stats << " had_stall=" << had_stall 
+                << " overall_chunks=" << overall_chunks << " overall_high_ssim_chunks=" << overall_high_ssim_chunks 
+                << " overall_ssim_1_chunks=" << overall_ssim_1_chunks << " out_of_range_ts=" << n_bad_ts << "\n";
+            constexpr double US_PER_HOUR = 3600.0 * 1000000;
+            out << "#total_extent=" << total_extent / US_PER_HOUR << " total_time_after_startup=" << total_time_after_startup / US_PER_HOUR << " total_stall_time=" << total_stall_time / US_PER_HOUR << "\n";
+
+            Metrics & metrics = Metrics::get();
+            metrics.count("streams", num_sessions);
+            metrics.count("good_streams", good_sessions);
+            metrics.count("missing_sysinfo", missing_sysinfo);
+            metrics.count("missing_video_stats", missing_video_stats);
+            metrics.count("chunks", overall_chunks);
+        }
 
-                if (mean_delivery_rate < 0 ) {
-                    missing_video_stats++;
-                } else {
-                    overall_chunks += total_chunks;
-                    overall_high_ssim_chunks += high_ssim_chunks;
-                    overall_ssim_1_chunks += ssim_1_chunks;
-                }
-
-                cout << fixed;
-
-                // ts from influx export include nanoseconds -- truncate to seconds
-                cout << (summary.base_time / 1000000000) << " " << (summary.valid ? "good " : "bad ") << (summary.full_extent ? "full " : "trunc " ) << summary.bad_reason << " "
-                    << summary.scheme << " " << inet_ntoa({sysinfo.ip.value()})
-                    << " " << ostable.reverse_map(sysinfo.os.value())
-                    << " " << channel_changes << " init=" << summary.init_id << " extent=" << summary.time_extent
-                    << " used=" << 100 * summary.time_at_last_play / summary.time_extent << "%"
-                    << " mean_ssim=" << mean_ssim
-                    << " mean_delivery_rate=" << mean_delivery_rate
-                    << " average_bitrate=" << average_bitrate
-                    << " ssim_variation_db=" << ssim_variation
-                    << " startup_delay=" << summary.cum_rebuf_at_startup
-                    << " total_after_startup=" << (summary.time_at_last_play - summary.time_at_startup)
-                    << " stall_after_startup=" << (summary.cum_rebuf_at_last_play - summary.cum_rebuf_at_startup) 
-                    << "\n";
-
-                total_extent += summary.time_extent;
-
-                if (summary.valid) {    // valid = "good"
-                    good_sessions++;
-                    total_time_after_startup += (summary.time_at_last_play - summary.time_at_startup);
-                    if (summary.cum_rebuf_at_last_play > summary.cum_rebuf_at_startup) {
-                        had_stall++;
-                        total_stall_time += (summary.cum_rebuf_at_last_play - summary.cum_rebuf_at_startup);
+        /* --stream: a finalized stream, as output */
+        struct FinalizedStream {
+            bool output_full = false;   // output as full, where a later event would make batch mode say trunc
+            bool good = false;
+            bool mislabelled = false;   // output_full, and a later event has arrived
+        };
+
+        /* --stream: streams not yet finalized, and those finalized (whose later records are dropped) */
+        struct StreamState {
+            dense_hash_map<session_key, ActiveStream, boost::hash<session_key>> active;
+            dense_hash_map<session_key, FinalizedStream, boost::hash<session_key>> finalized;
+            AnalysisTotals totals{};
+            size_t n_late_records = 0;
+            size_t n_mislabelled_full = 0;  // streams output as full, then found (by a late event) to be trunc
+
+            StreamState()
+                : active(), finalized()
+            {
+                active.set_empty_key({0,0,0,-1,-1});
+                active.set_deleted_key({0,0,0,-1,-2});
+                finalized.set_empty_key({0,0,0,-1,-1});
+            }
+
+            /* Stream with key, started if new; nullptr if already finalized.
+             * A late event of a stream output as full means batch mode would have labelled it
+             * trunc (event_interval>8s): count it, and take it back out of good_and_full. */
+            ActiveStream * get(const session_key & key, const bool is_event) {
+                const auto it = active.find(key);
+                if (it != active.end()) {
+                    return &it->second;
+                }
+                const auto finalized_it = finalized.find(key);
+                if (finalized_it != finalized.end()) {
+                    n_late_records++;
+                    FinalizedStream & stream = finalized_it->second;
+                    if (is_event and stream.output_full and not stream.mislabelled) {
+                        stream.mislabelled = true;
+                        n_mislabelled_full++;
+                        if (stream.good) {
+                            totals.good_and_full--;
+                        }
+                    }
+                    return nullptr;
+                }
+                return &active[key];
+            }
+        };
+
+        /* --stream: move records with ts < before out of the tables: usable Events and VideoSents
+         * into their active streams, and usable Sysinfos into sysinfos */
+        void drain_tables(const uint64_t before, StreamState & streams) {
+            for (uint8_t server = 0; server < SERVER_COUNT; server++) {
+                client_sysinfo[server].drain_before(before, [&](const uint64_t ts, const Sysinfo & sysinfo) {
+                    if (usable(sysinfo, ts, "sysinfo") and add_sysinfo(sysinfo)) {
+                        index_sysinfo({*sysinfo.init_id(), *sysinfo.user_id(), *sysinfo.expt_id()});
+                    }
+                });
+                for (uint8_t channel = 0; channel < Channel::COUNT; channel++) {
+                    client_buffer[server][channel].drain_before(before, [&](const uint64_t ts, const Event & event) {
+                        if (not usable(event, ts, "event")) {
+                            return;
+                        }
+                        if (ActiveStream * stream = streams.get({*event.init_id(), *event.user_id(), *event.expt_id(), server, channel}, true)) {
+                            stream->events.emplace_back(ts, event);
+                            stream->last_ts = max(stream->last_ts, ts);
+                        }
+                    });
+                    video_sent[server][channel].drain_before(before, [&](const uint64_t ts, const VideoSent & videosent) {
+                        if (not usable(videosent, ts, "videosent")) {
+                            return;
+                        }
+                        if (ActiveStream * stream = streams.get({*videosent.init_id(), *videosent.user_id(), *videosent.expt_id(), server, channel}, false)) {
+                            stream->chunks.emplace_back(ts, videosent);
+                            stream->last_ts = max(stream->last_ts, ts);
+                        }
+                    });
+                }
+            }
+        }
+
+        /* --stream: output (as text to cout, or to store if not null) and free each active stream with
+         * no records since idle_before (all of them, given UINT64_MAX). As in batch mode, chunks
+         * without events aren't output. */
+        void finalize_streams(const uint64_t idle_before, StreamState & streams, const string_table & os_names,
+                              summarystore::Writer * const store) {
+            for (auto it = streams.active.begin(); it != streams.active.end(); ) {
+                const auto & [key, stream] = *it;
+                if (stream.last_ts >= idle_before) {
+                    ++it;
+                    continue;
+                }
+
+                FinalizedStream & finalized = streams.finalized[key];
+                if (not stream.events.empty()) {
+                    vector<pair<uint64_t, const Event*>> events;
+                    events.reserve(stream.events.size());
+                    for (const auto & [ts, event] : stream.events) {
+                        events.emplace_back(ts, &event);
                     }
-                    if (summary.full_extent) {
-                        good_and_full++;
+                    vector<pair<uint64_t, const VideoSent*>> chunk_stream;
+                    chunk_stream.reserve(stream.chunks.size());
+                    for (const auto & [ts, videosent] : stream.chunks) {
+                        chunk_stream.emplace_back(ts, &videosent);
+                    }
+                    const Span<pair<uint64_t, const VideoSent*>> chunk_span{chunk_stream};
+                    const Span<pair<uint64_t, const Event*>> event_span{events};
+                    const summarystore::Row row = analyze_stream(key, event_span, chunk_stream.empty() ? nullptr : &chunk_span,
+                                                                 find_stream_sysinfo(key, event_span), os_names, streams.totals);
+                    if (store) {
+                        store->add(row);
+                    } else {
+                        print_stream(row, cout);
                     }
+                    // summarize stops at a stall_while_playing before it would reach a gap
+                    finalized.output_full = row.full and row.bad_reason != "stall_while_playing";
+                    finalized.good = row.good;
                 }
+
+                streams.active.erase(it++);
             }
+        }
 
-            // mark summary lines with # so confinterval will ignore them
-            cout << "#num_sessions=" << sessions.size() << " good=" << good_sessions << " good_and_full=" << good_and_full << " missing_sysinfo=" << missing_sysinfo << " missing_video_stats=" << missing_video_stats << " had_stall=" << had_stall 
-                 << " overall_chunks=" << overall_chunks << " overall_high_ssim_chunks=" << overall_high_ssim_chunks 
-                 << " overall_ssim_1_chunks=" << overall_ssim_1_chunks << " out_of_range_ts=" << n_bad_ts << "\n";
-            cout << "#total_extent=" << total_extent / 3600.0 << " total_time_after_startup=" << total_time_after_startup / 3600.0 << " total_stall_time=" << total_stall_time / 3600.0 << "\n";
+        /* Parse influxDB export sorted by timestamp (the last field of each line), outputting each
+         * stream once it goes idle, rather than after the whole export is parsed -- so memory
+         * scales with the streams active at once, rather than with the day.
+         * Records are complete once a later timestamp is seen, so every STREAM_DRAIN_INTERVAL
+         * of export time they're drained into their streams, and streams idle for idle_timeout
+         * seconds are finalized. Output is as in batch mode, except for a stream with records after
+         * going idle: batch mode marks it trunc (event_interval>8s) and includes them in its extent
+         * and chunk stats, here they're dropped. The trailer counts them, and the streams already
+         * output as full that a late event shows to be trunc (which are left out of good_and_full)
+         * -- a longer idle_timeout trades memory for fewer such streams.
+         * Sysinfos are kept throughout, since older streams look up their session's first one.
+         * Streams go to store if not null, as in analyze_sessions. */
+        void parse_and_analyze_stream(LineReader & reader, summarystore::Writer * const store = nullptr,
+                                      const unsigned int idle_timeout = DEFAULT_IDLE_TIMEOUT) {
+            if (idle_timeout <= MAX_EVENT_INTERVAL) {
+                throw runtime_error("idle timeout must exceed " + to_string(unsigned(MAX_EVENT_INTERVAL)) + " seconds");
+            }
+
+            unsigned int line_no = 0;
+            ParseState state = lend_state();
+            StreamState streams;
+            string_view line;
+
+            uint64_t latest_ts = 0;     // latest ts of a line passed to parse_line
+            uint64_t drained_ts = 0;    // records before this ts have been drained; a line before it is out of order
+
+            while (true) {
+                print_progress(line_no);
+
+                if (not reader.get_line(line)) {
+                    break;
+                }
+                line_no++;
+
+                if (not prefilter(line)) {
+                    continue;
+                }
+
+                const optional<uint64_t> timestamp = line_timestamp(line);
+                if (timestamp) {
+                    if (*timestamp < drained_ts) {
+                        throw runtime_error("--stream requires export sorted by timestamp, but line "
+                                            + to_string(line_no) + " is out of order");
+                    }
+                    latest_ts = max(latest_ts, *timestamp);
+                }
+                parse_line(line, line_no, state);
+
+                if (latest_ts - drained_ts >= STREAM_DRAIN_INTERVAL) {
+                    try {
+                        drain_tables(latest_ts, streams);
+                    } catch (const runtime_error & e) {
+                        // e.g. an incomplete record, whose other fields come later in an unsorted export
+                        throw runtime_error(e.what() + " (--stream requires export sorted by timestamp)"s);
+                    }
+                    drained_ts = latest_ts;
+                    finalize_streams(drained_ts - idle_timeout * NS_PER_SEC, streams, state.ostable, store);
+                }
+            }
+            drain_tables(UINT64_MAX, streams);
+            finalize_streams(UINT64_MAX, streams, state.ostable, store);
+            print_skipped();
+
+            if (streams.n_late_records > 0) {
+                cerr << "dropped " << streams.n_late_records << " records of streams already finalized\n";
+            }
+            adopt_state(state);
+            ostream & out = store ? cerr : cout;
+            print_totals(streams.totals, out);
+            out << "#late_records=" << streams.n_late_records << " mislabelled_full=" << streams.n_mislabelled_full << "\n";
+
+            Metrics & metrics = Metrics::get();
+            metrics.count("late_records", streams.n_late_records);
+            metrics.count("mislabelled_full", streams.n_mislabelled_full);
         }
 
         /* Summarize a list of Videosents, ignoring SSIM ~ 1 */
         // normal_ssim_chunks, ssim_1_chunks, total_chunks, ssim_sum, mean_delivery_rate, average_bitrate, ssim_variation]
-        tuple<size_t, size_t, size_t, double, double, double, double> video_summarize(const session_key & key) const {
-            const auto videosent_it = chunks.find(key);
-            if (videosent_it == chunks.end()) {
+        tuple<size_t, size_t, size_t, double, double, double, double> video_summarize(
+                const Span<pair<uint64_t, const VideoSent *>> * chunks_or_null) const {
+            if (not chunks_or_null) {
                 return { -1, -1, -1, -1, -1, -1, -1 };
             }
 
-            const vector<pair<uint64_t, const VideoSent *>> & chunk_stream = videosent_it->second;
+            const Span<pair<uint64_t, const VideoSent *>> & chunk_stream = *chunks_or_null;
 
             double ssim_sum = 0;    // raw index
             double delivery_rate_sum = 0;
@@ -1002,7 +3026,7 @@ class Parser {
             size_t num_ssim_1_chunks = 0;
 
             for ( const auto [ts, videosent] : chunk_stream ) {
-                float raw_ssim = videosent->ssim_index.value(); // would've thrown by this point if not set
+                float raw_ssim = videosent->ssim_index().value(); // would've thrown by this point if not set
                 if (raw_ssim == 1.0) {
                     num_ssim_1_chunks++; 
                 }
@@ -1021,8 +3045,8 @@ class Parser {
 
                 ssim_last_db = ssim_cur_db;
 
-                delivery_rate_sum += videosent->delivery_rate.value();
-                bytes_sent_sum += videosent->size.value();
+                delivery_rate_sum += videosent->delivery_rate().value();
+                bytes_sent_sum += videosent->size().value();
             }
 
             const double average_bitrate = 8 * bytes_sent_sum / (2.002 * chunk_stream.size());
@@ -1036,7 +3060,7 @@ class Parser {
         }
 
         /* Summarize a list of events corresponding to a stream. */
-        EventSummary summarize(const session_key & key, const vector<pair<uint64_t, const Event*>> & events) const {
+        EventSummary summarize(const session_key & key, const Span<pair<uint64_t, const Event*>> & events) const {
             const auto & [init_id, uid, expt_id, server, channel] = key;
 
             EventSummary ret;
@@ -1071,13 +3095,13 @@ class Parser {
 
                 const float relative_time = (ts - base_time) / 1000000000.0;
 
-                if (relative_time - last_sample > 8.0) {
+                if (relative_time - last_sample > MAX_EVENT_INTERVAL) {
                     ret.bad_reason = "event_interval>8s";
                     ret.full_extent = false;
                     break;  // trunc, but not necessarily bad
                 }
 
-                if (event->buffer.value() > 0.3) {
+                if (event->buffer().value() > 0.3) {
                     time_low_buffer_started.reset();
                 } else {
                     if (not time_low_buffer_started.has_value()) {
@@ -1094,37 +3118,37 @@ class Parser {
                     }
                 }
 
-                if (event->buffer.value() > 5 and last_buffer > 5) {
-                    if (event->cum_rebuf.value() > last_cum_rebuf + 0.15) {
+                if (event->buffer().value() > 5 and last_buffer > 5) {
+                    if (event->cum_rebuf().value() > last_cum_rebuf + 0.15) {
                         // stall with plenty of buffer --> slow decoder?
                         ret.bad_reason = "stall_while_playing";
                         return ret; // BAD
                     }
                 }
 
-                switch (event->type.value().type) {
+                switch (event->type().value().type) {
                     case Event::EventType::Type::init:
                         break;
                     case Event::EventType::Type::play:
                         playing = true;
                         ret.time_at_last_play = relative_time;
-                        ret.cum_rebuf_at_last_play = event->cum_rebuf.value();
+                        ret.cum_rebuf_at_last_play = event->cum_rebuf().value();
                         break;
                     case Event::EventType::Type::startup:
                         if ( not started ) {
                             ret.time_at_startup = relative_time;
-                            ret.cum_rebuf_at_startup = event->cum_rebuf.value();
+                            ret.cum_rebuf_at_startup = event->cum_rebuf().value();
                             started = true;
                         }
 
                         playing = true;
                         ret.time_at_last_play = relative_time;
-                        ret.cum_rebuf_at_last_play = event->cum_rebuf.value();
+                        ret.cum_rebuf_at_last_play = event->cum_rebuf().value();
                         break;
                     case Event::EventType::Type::timer:
                         if ( playing ) {
                             ret.time_at_last_play = relative_time;
-                            ret.cum_rebuf_at_last_play = event->cum_rebuf.value();
+                            ret.cum_rebuf_at_last_play = event->cum_rebuf().value();
                         }
                         break;
                     case Event::EventType::Type::rebuffer:
@@ -1133,8 +3157,8 @@ class Parser {
                 }
 
                 last_sample = relative_time;
-                last_buffer = event->buffer.value();
-                last_cum_rebuf = event->cum_rebuf.value();
+                last_buffer = event->buffer().value();
+                last_cum_rebuf = event->cum_rebuf().value();
             }   // end for
 
             // zeroplayed and neverstarted are both counted as "didn't begin playing" in paper
@@ -1161,14 +3185,91 @@ class Parser {
         }
 };
 
-void analyze_main(const string & experiment_dump_filename, Day_ns start_ts) {
-    Parser parser{ experiment_dump_filename, start_ts };
+/* Command-line settings (besides experiment dump and date) */
+struct AnalyzeOptions {
+    string input_filename{};        // influx export; empty for stdin
+    string tsm_datadir{};           // instead of export, read the TSM files of this influx backup
+    unsigned int parse_threads = 1; // > 1: parse in parallel, sharded by server
+    bool stream = false;            // output streams as they go idle (export must be sorted by timestamp)
+    unsigned int idle_timeout = 0;  // with stream: seconds idle before a stream is output (0: default)
+    string batch_filename{};        // analyze the days listed in this file, rather than one
+    bool sorted_join = false;       // find streams' chunks and sysinfos by merge join, rather than hash lookups
+    size_t memory_budget_mib = 0;   // > 0: spill parsed tables to disk beyond this size
+    string spill_dir = "/tmp";      // where to spill them
+    bool columnar = false;          // output a summary store (summarystore.hh) rather than text
+};
+
+/* Write the stream summaries of a day (--columnar) to cout */
+void write_store(summarystore::Writer & store) {
+    MetricsPhase phase{"write_columnar"};
+    Metrics::get().count("columnar_partitions", store.partitions());
+    Metrics::get().count("columnar_bytes", store.write(cout));
+    cout.flush();
+    if (not cout) {
+        throw runtime_error("error writing columnar output");
+    }
+}
+
+/* Analyze one day's input (per options) with parser, which is set to that day, writing to cout */
+void analyze_day(Parser & parser, const AnalyzeOptions & options) {
+    parser.set_memory_budget(options.memory_budget_mib * 1024 * 1024, options.spill_dir);
+    summarystore::Writer store;
+    summarystore::Writer * const store_or_null = options.columnar ? &store : nullptr;
+    if (not options.tsm_datadir.empty()) {
+        MetricsPhase phase{"parse_tsm"};
+        parser.parse_tsm(options.tsm_datadir, options.parse_threads);
+    } else {
+        // influx export is read in large blocks from stdin, or mmapped if given as a file
+        unique_ptr<LineReader> reader = options.input_filename.empty() 
+            ? make_unique<LineReader>() : make_unique<LineReader>(options.input_filename);
+        if (options.stream) {
+            MetricsPhase phase{"parse_and_analyze_stream"};
+            if (options.idle_timeout > 0) {
+                parser.parse_and_analyze_stream(*reader, store_or_null, options.idle_timeout);
+            } else {
+                parser.parse_and_analyze_stream(*reader, store_or_null);
+            }
+            phase.add_input(parser.lines_read(), parser.bytes_read());
+            parser.count_metrics();
+            if (options.columnar) {
+                write_store(store);
+            }
+            return;
+        }
+        MetricsPhase phase{"parse"};
+        if (options.parse_threads > 1) {
+            parser.parse_stdin_parallel(*reader, options.parse_threads);
+        } else {
+            parser.parse_stdin(*reader);
+        }
+        phase.add_input(parser.lines_read(), parser.bytes_read());
+    }
+    // group with as many threads as parsed
+    {
+        MetricsPhase phase{"accumulate_sessions"};
+        parser.accumulate_sessions(options.parse_threads);
+    }
+    {
+        MetricsPhase phase{"accumulate_sysinfos"};
+        parser.accumulate_sysinfos(options.parse_threads);
+    }
+    {
+        MetricsPhase phase{"accumulate_video_sents"};
+        parser.accumulate_video_sents(options.parse_threads);
+    }
+    {
+        MetricsPhase phase{"analyze_sessions"};
+        parser.analyze_sessions(options.parse_threads, options.sorted_join, store_or_null);
+    }
+    parser.count_metrics();
+    if (options.columnar) {
+        write_store(store);
+    }
+}
 
-    parser.parse_stdin();
-    parser.accumulate_sessions();
-    parser.accumulate_sysinfos();
-    parser.accumulate_video_sents(); 
-    parser.analyze_sessions();
+void analyze_main(const string & experiment_dump_filename, Day_ns start_ts, const AnalyzeOptions & options) {
+    Parser parser{ experiment_dump_filename, start_ts };
+    analyze_day(parser, options);
 }
 
 /* Parse date to Unix timestamp (nanoseconds) at Influx backup hour, 
@@ -1187,29 +3288,255 @@ optional<Day_ns> parse_date(const string & date) {
     return start_ts;
 }
 
+/* Analyze each day listed in options.batch_filename, one per line as "date input output":
+ * input is an influx export (a file or named pipe), or the data directory of an influx backup
+ * (as with --tsm); output is the file to write the day's analysis to.
+ * One Parser analyzes every day in turn, reusing its experiments, string tables, and storage.
+ * A day that fails stops the batch, leaving the outputs of the days before it. */
+void analyze_batch(const string & experiment_dump_filename, const AnalyzeOptions & options) {
+    ifstream batch{options.batch_filename};
+    if (not batch.is_open()) {
+        throw runtime_error("can't open batch list " + options.batch_filename);
+    }
+
+    unique_ptr<Parser> parser;
+    string line;
+    unsigned int line_no = 0;
+    while (getline(batch, line)) {
+        line_no++;
+        if (line.empty() or line.front() == '#') {
+            continue;
+        }
+        istringstream fields{line};
+        string date, input, output;
+        if (not (fields >> date >> input >> output)) {
+            throw runtime_error("batch list line " + to_string(line_no) + ": expected date, input and output");
+        }
+        const optional<Day_ns> start_ts = parse_date(date);
+        if (not start_ts) {
+            throw runtime_error("batch list line " + to_string(line_no) + ": can't parse date " + date);
+        }
+
+        AnalyzeOptions day_options = options;
+        struct stat input_stat{};
+        if (stat(input.c_str(), &input_stat) == 0 and S_ISDIR(input_stat.st_mode)) {
+            if (options.stream) {
+                throw runtime_error("batch list line " + to_string(line_no) + ": --stream can't read a backup's TSM files");
+            }
+            day_options.tsm_datadir = input;
+        } else {
+            day_options.input_filename = input;
+        }
+
+        ofstream out{output};
+        if (not out.is_open()) {
+            throw runtime_error("can't open output " + output);
+        }
+        cerr << "analyzing " << date << ": " << input << " => " << output << "\n";
+        Metrics::get().begin_run(date);
+        if (parser) {
+            parser->start_day(start_ts.value());
+        } else {
+            parser = make_unique<Parser>(experiment_dump_filename, start_ts.value());
+        }
+
+        // analyze writes to cout; send it to this day's output meanwhile
+        streambuf * const cout_buf = cout.rdbuf(out.rdbuf());
+        try {
+            analyze_day(*parser, day_options);
+        } catch (...) {
+            cout.rdbuf(cout_buf);
+            throw;
+        }
+        cout.rdbuf(cout_buf);
+        out.close();
+        if (out.fail()) {
+            throw runtime_error("error writing " + output);
+        }
+    }
+}
+
+#ifndef ANALYZE_NO_MAIN     // bench_analyze.cc includes this file for its kernels
+
+void print_usage(const string & program) {
+    cerr << "Usage: " << program << " [--columnar] [--parse-threads <n>] [--sorted-join] [--memory-budget <MiB> [--spill-dir <dir>]] expt_dump [from postgres] date [e.g. 2019-07-01T11_2019-07-02T11] [influx_export]\n"
+            "       " << program << " [--columnar] --stream [--idle-timeout <s>] expt_dump date [influx_export]\n"
+            "       " << program << " [--parse-threads <n>] [--sorted-join] [--memory-budget <MiB> ...] --tsm <datadir> expt_dump date\n"
+            "       " << program << " [options above, except --tsm] --batch <list> expt_dump\n"
+            "influx_export: file containing influx export (default, or -: stdin)\n"
+            "--tsm: read the TSM files of an unpacked influx backup (datadir/puffer/retention32d/*/*.tsm)\n"
+            "       directly, rather than its influx_inspect export\n"
+            "--parse-threads: number of threads parsing the export, each owning a subset of servers,\n"
+            "                 and then grouping records into streams and summarizing them (default 1);\n"
+            "                 streams are output in order of start time either way\n"
+            "--sorted-join: find each stream's chunks and sysinfo by sorting streams, chunks and sysinfos\n"
+            "               and merging them in one pass, rather than a hash lookup per stream (same output)\n"
+            "--memory-budget: MiB of parsed records to hold in memory while parsing; beyond it, the records of\n"
+            "                 the servers least recently parsed are spilled to temporary files, and read back\n"
+            "                 once parsing is done (same output; each of --parse-threads gets an equal share)\n"
+            "--spill-dir: directory for those files (default /tmp)\n"
+            "--stream: output each stream once it goes idle, holding only active streams in memory;\n"
+            "          influx_export must be sorted by timestamp (the last field of each line)\n"
+            "--idle-timeout: with --stream, seconds without data before a stream is output (default 60);\n"
+            "                records of a stream after it's output are dropped, so a stream pausing for\n"
+            "                longer is output differently than without --stream (labelled full, with a\n"
+            "                shorter extent and fewer chunks); the #late_records trailer counts them\n"
+            "--batch: analyze several days in one process, sharing experiments, string tables and memory;\n"
+            "         each line of list is \"date input output\", where input is an influx export (file or\n"
+            "         named pipe) or an influx backup's datadir (as with --tsm), and output is a file\n"
+            "--columnar: output the stream summaries as a columnar store, partitioned by day (for\n"
+            "            confinterval and schemedays to read without parsing text), rather than as text;\n"
+            "            the summary lines (#...) go to stderr\n"
+            "PUFFER_METRICS=<file> in the environment: write per-phase timings, RSS and counts as JSON\n"
+            "                      to file (e.g. /dev/fd/3)\n";
+}
+
 /* Must take date as argument, to filter out extra data from influx export */
 int main(int argc, char *argv[]) {
+    Metrics & metrics = Metrics::get();
+    metrics.set_program("analyze");
     try {
         if (argc <= 0) {
             abort();
         }
 
-        if (argc != 3) {
-            cerr << "Usage: " << argv[0] << " expt_dump [from postgres] date [e.g. 2019-07-01T11_2019-07-02T11]\n";
+        const option opts[] = {
+            {"parse-threads", required_argument, nullptr, 'p'},
+            {"stream", no_argument, nullptr, 's'},
+            {"idle-timeout", required_argument, nullptr, 'i'},
+            {"tsm", required_argument, nullptr, 't'},
+            {"sorted-join", no_argument, nullptr, 'j'},
+            {"batch", required_argument, nullptr, 'b'},
+            {"memory-budget", required_argument, nullptr, 'm'},
+            {"spill-dir", required_argument, nullptr, 'd'},
+            {"columnar", no_argument, nullptr, 'c'},
+            {nullptr, 0, nullptr, 0}
+        };
+        AnalyzeOptions options;
+
+        while (true) {
+            const int opt = getopt_long(argc, argv, "p:si:t:jb:m:d:c", opts, nullptr);
+            if (opt == -1) break;
+            switch (opt) {
+                case 'p': {
+                    const int parse_threads = atoi(optarg);
+                    if (parse_threads < 1) {
+                        cerr << "Error: --parse-threads must be at least 1\n";
+                        return EXIT_FAILURE;
+                    }
+                    options.parse_threads = parse_threads;
+                    break;
+                }
+                case 's':
+                    options.stream = true;
+                    break;
+                case 'i': {
+                    const int idle_timeout = atoi(optarg);
+                    if (idle_timeout < 1) {
+                        cerr << "Error: --idle-timeout must be at least 1\n";
+                        return EXIT_FAILURE;
+                    }
+                    options.idle_timeout = idle_timeout;
+                    break;
+                }
+                case 't':
+                    options.tsm_datadir = optarg;
+                    break;
+                case 'j':
+                    options.sorted_join = true;
+                    break;
+                case 'b':
+                    options.batch_filename = optarg;
+                    break;
+                case 'm': {
+                    const int memory_budget_mib = atoi(optarg);
+                    if (memory_budget_mib < 1) {
+                        cerr << "Error: --memory-budget must be at least 1 (MiB)\n";
+                        return EXIT_FAILURE;
+                    }
+                    options.memory_budget_mib = memory_budget_mib;
+                    break;
+                }
+                case 'd':
+                    options.spill_dir = optarg;
+                    break;
+                case 'c':
+                    options.columnar = true;
+                    break;
+                default:
+                    print_usage(argv[0]);
+                    return EXIT_FAILURE;
+            }
+        }
+
+        if (options.stream and options.parse_threads > 1) {
+            cerr << "Error: --stream parses on one thread; it can't be combined with --parse-threads\n";
+            return EXIT_FAILURE;
+        }
+        if (options.idle_timeout > 0 and not options.stream) {
+            cerr << "Error: --idle-timeout requires --stream\n";
+            return EXIT_FAILURE;
+        }
+
+        if (options.sorted_join and options.stream) {
+            cerr << "Error: --stream outputs each stream as it goes idle; it can't be combined with --sorted-join\n";
+            return EXIT_FAILURE;
+        }
+
+        if (options.memory_budget_mib > 0 and options.stream) {
+            cerr << "Error: --stream outputs and drops records as it goes; it can't be combined with --memory-budget\n";
+            return EXIT_FAILURE;
+        }
+
+        if (not options.tsm_datadir.empty() and options.stream) {
+            cerr << "Error: --stream reads export sorted by timestamp; it can't be combined with --tsm\n";
+            return EXIT_FAILURE;
+        }
+
+        const int n_positional = argc - optind;
+        if (not options.batch_filename.empty()) {
+            if (not options.tsm_datadir.empty()) {
+                cerr << "Error: with --batch, give each day's backup datadir in the list rather than --tsm\n";
+                return EXIT_FAILURE;
+            }
+            if (n_positional != 1) {
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            analyze_batch(argv[optind], options);
+            metrics.write();
+            return EXIT_SUCCESS;
+        }
+
+        if (n_positional != 2 and n_positional != 3) {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (n_positional == 3 and not options.tsm_datadir.empty()) {
+            cerr << "Error: --tsm reads the backup instead of influx export; don't give both\n";
             return EXIT_FAILURE;
         }
 
-        optional<Day_ns> start_ts = parse_date(argv[2]); 
+        optional<Day_ns> start_ts = parse_date(argv[optind + 1]); 
         if (not start_ts) {
             cerr << "Date argument could not be parsed; format as 2019-07-01T11_2019-07-02T11\n";
             return EXIT_FAILURE;
         }
         
-        analyze_main(argv[1], start_ts.value());
+        if (n_positional == 3 and argv[optind + 2] != "-"s) {
+            options.input_filename = argv[optind + 2];
+        }
+        metrics.begin_run(argv[optind + 1]);
+        analyze_main(argv[optind], start_ts.value(), options);
     } catch (const exception & e) {
         cerr << e.what() << "\n";
+        metrics.set_error(e.what());
+        metrics.write();
         return EXIT_FAILURE;
     }
 
+    metrics.write();
     return EXIT_SUCCESS;
 }
+
+#endif
@@ -0,0 +1,116 @@
+/* Bump allocation for data that lives as long as an analysis (e.g. analyze's streams), and views of it. */
+
+#ifndef ARENA_HH
+#define ARENA_HH
+
+#include <vector>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+
+/**
+ * Hands out uninitialized arrays from large blocks, by bumping a pointer; nothing is freed until
+ * the arena is destroyed (or reset), which frees a handful of blocks rather than every array.
+ * Only for trivially destructible types, since their destructors are never run.
+ */
+class Arena {
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 4 * 1024 * 1024;
+
+    size_t block_size_;
+    std::vector<std::unique_ptr<char[]>> blocks_{};         // block_size_ each
+    size_t used_blocks_ = 0;                                // blocks_[0, used_blocks_) are in use
+    std::vector<std::unique_ptr<char[]>> large_blocks_{};   // one per large array
+    char * pos_ = nullptr;     // free space of the current block is [pos_, end_)
+    char * end_ = nullptr;
+    size_t allocated_ = 0;     // bytes handed out (excluding alignment padding)
+
+    public:
+    explicit Arena(const size_t block_size = DEFAULT_BLOCK_SIZE) : block_size_(block_size) {}
+
+    Arena(const Arena &) = delete;
+    Arena & operator=(const Arena &) = delete;
+
+    // moving hands over the blocks themselves, so arrays already allocated stay where they are
+    Arena(Arena && other) noexcept
+        : block_size_(other.block_size_), blocks_(std::move(other.blocks_)),
+          used_blocks_(std::exchange(other.used_blocks_, 0)), large_blocks_(std::move(other.large_blocks_)),
+          pos_(std::exchange(other.pos_, nullptr)), end_(std::exchange(other.end_, nullptr)),
+          allocated_(std::exchange(other.allocated_, 0)) {}
+
+    Arena & operator=(Arena && other) noexcept {
+        block_size_ = other.block_size_;
+        blocks_ = std::move(other.blocks_);
+        used_blocks_ = std::exchange(other.used_blocks_, 0);
+        large_blocks_ = std::move(other.large_blocks_);
+        pos_ = std::exchange(other.pos_, nullptr);
+        end_ = std::exchange(other.end_, nullptr);
+        allocated_ = std::exchange(other.allocated_, 0);
+        return *this;
+    }
+
+    /* Storage for n objects of type T, valid for the lifetime of the arena (or until reset) */
+    template <class T>
+    T * allocate(const size_t n) {
+        static_assert(std::is_trivially_destructible_v<T>, "Arena never runs destructors");
+        const size_t size = n * sizeof(T);
+        allocated_ += size;
+
+        char * const aligned = pos_ + (-reinterpret_cast<uintptr_t>(pos_) & (alignof(T) - 1));
+        if (pos_ and size <= size_t(end_ - pos_) and aligned <= end_ - size) {
+            pos_ = aligned + size;
+            return reinterpret_cast<T *>(aligned);
+        }
+
+        // blocks come from operator new, so they're aligned for any T
+        if (size > block_size_ / 4) {
+            // large array: a block of its own, leaving the current block's free space for later
+            large_blocks_.emplace_back(new char[size]);
+            return reinterpret_cast<T *>(large_blocks_.back().get());
+        }
+        if (used_blocks_ == blocks_.size()) {
+            blocks_.emplace_back(new char[block_size_]);
+        }
+        char * const block = blocks_[used_blocks_++].get();
+        pos_ = block + size;
+        end_ = block + block_size_;
+        return reinterpret_cast<T *>(block);
+    }
+
+    /* Invalidate everything allocated, keeping the regular blocks to allocate from again */
+    void reset() {
+        used_blocks_ = 0;
+        large_blocks_.clear();
+        pos_ = end_ = nullptr;
+        allocated_ = 0;
+    }
+
+    size_t allocated() const { return allocated_; }
+};
+
+/* View of a contiguous array (e.g. one from an Arena), with the read side of a vector's interface */
+template <class T>
+class Span {
+    T * data_ = nullptr;
+    size_t size_ = 0;
+
+    public:
+    Span() {}
+    Span(T * const data, const size_t size) : data_(data), size_(size) {}
+
+    template <class Alloc>
+    explicit Span(std::vector<T, Alloc> & vec) : data_(vec.data()), size_(vec.size()) {}
+
+    T * data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    T & operator[](const size_t i) const { return data_[i]; }
+    T & front() const { return data_[0]; }
+    T & back() const { return data_[size_ - 1]; }
+
+    T * begin() const { return data_; }
+    T * end() const { return data_ + size_; }
+};
+
+#endif
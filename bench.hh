@@ -0,0 +1,87 @@
+/* Timing loop for the microbenchmarks of analyze's and confinterval's kernels (bench_analyze, bench_confinterval) */
+
+#ifndef BENCH_HH
+#define BENCH_HH
+
+#include <string>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+
+/* Keep the compiler from optimizing away the computation of value */
+template <class T>
+inline void do_not_optimize(const T & value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/* Discards cerr (e.g. the kernels' progress lines, once per call) while in scope */
+class QuietStderr {
+    std::streambuf * saved_ = std::cerr.rdbuf(nullptr);
+
+    public:
+    QuietStderr() {}
+    QuietStderr(const QuietStderr &) = delete;
+    QuietStderr & operator=(const QuietStderr &) = delete;
+
+    ~QuietStderr() {
+        std::cerr.rdbuf(saved_);
+        std::cerr.clear();
+    }
+};
+
+/**
+ * Runs the benchmarks whose name contains filter, printing one line each to cout.
+ * A benchmark is a function, each call of which performs ops operations (on lines lines of input,
+ * or 0 if it isn't a parser). It is called in several rounds of at least ROUND_SECONDS, and the
+ * fastest round -- the one least disturbed by the rest of the machine -- is reported as ns/op
+ * (and lines/s).
+ */
+class BenchRunner {
+    constexpr static unsigned int ROUNDS = 5;
+    constexpr static double ROUND_SECONDS = 0.2;
+
+    std::string filter_;
+
+    public:
+    constexpr static int NAME_WIDTH = 64;   // of the benchmark's name, in each line of output
+
+    explicit BenchRunner(const std::string & filter) : filter_(filter) {}
+
+    /* Whether the benchmark (or check) called name is to be run */
+    bool selected(const std::string & name) const { return name.find(filter_) != std::string::npos; }
+
+    template <class F>
+    void run(const std::string & name, const size_t ops, const size_t lines, F && fn) const {
+        if (not selected(name)) {
+            return;
+        }
+
+        double best_s = std::numeric_limits<double>::infinity();    // per call
+        {
+            QuietStderr quiet;
+            fn();   // warm up caches, tables and arenas
+            for (unsigned int round = 0; round < ROUNDS; round++) {
+                const auto start = std::chrono::steady_clock::now();
+                size_t calls = 0;
+                double elapsed_s;
+                do {
+                    fn();
+                    calls++;
+                    elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                } while (elapsed_s < ROUND_SECONDS);
+                best_s = std::min(best_s, elapsed_s / calls);
+            }
+        }
+
+        std::cout << std::left << std::setw(NAME_WIDTH) << name << std::right << std::fixed
+                  << std::setprecision(1) << std::setw(12) << best_s * 1e9 / ops << " ns/op";
+        if (lines > 0) {
+            std::cout << std::setprecision(0) << std::setw(14) << lines / best_s << " lines/s";
+        }
+        std::cout << std::endl;
+    }
+};
+
+#endif
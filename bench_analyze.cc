@@ -0,0 +1,250 @@
+/* Microbenchmarks of analyze's parsing and summarization kernels, each on its own, over a fixed input:
+ * bench/export.txt, ten minutes of influx export (20 sessions' client_buffer, client_sysinfo and
+ * video_sent) from 2020-01-10, whose expt_ids are in experiments/puffer.expt_jan9_2020.
+ * "make bench" runs it. */
+
+#define ANALYZE_NO_MAIN
+#include "analyze.cc"
+
+#include <bench.hh>
+
+/* Parser's streams and summarizers, for the benchmarks */
+class ParserBench {
+    public:
+    using session_key = Parser::session_key;
+    using EventSummary = Parser::EventSummary;
+    using Events = Span<pair<uint64_t, const Event *>>;
+    using Chunks = Span<pair<uint64_t, const VideoSent *>>;
+
+    struct Stream {
+        session_key key;
+        Events events;
+        const Chunks * chunks;      // nullptr if the stream has no video_sents
+    };
+
+    /* Streams of a parser that has accumulated its sessions and video_sents */
+    static vector<Stream> streams(const Parser & parser) {
+        vector<Stream> ret;
+        parser.sessions.for_each([&](const session_key & key, const Events & events) {
+            ret.push_back({key, events, parser.chunks.find(key)});
+        });
+        return ret;
+    }
+
+    static EventSummary summarize(const Parser & parser, const Stream & stream) {
+        return parser.summarize(stream.key, stream.events);
+    }
+
+    static double video_summarize(const Parser & parser, const Stream & stream) {
+        return get<3>(parser.video_summarize(stream.chunks));
+    }
+};
+
+/* Fields of one record (all of its lines' key=value, for one measurement, series and timestamp) */
+struct BenchRecord {
+    Measurement measurement;
+    vector<pair<string_view, string_view>> fields;
+};
+
+/* Lines of export, and their fields by kind, as parse_line would see them */
+struct Corpus {
+    string text{};
+    vector<string_view> lines{};
+    vector<string_view> timestamps{};
+    vector<string_view> floats{};               // e.g. buffer=12.345
+    vector<string_view> integers{};             // e.g. init_id=123i
+    vector<string_view> usernames{};            // unquoted
+    array<vector<BenchRecord>, measurements.size()> records{};
+    array<size_t, measurements.size()> n_fields{};
+
+    explicit Corpus(const string & filename) {
+        ifstream file{filename};
+        if (not file.is_open()) {
+            throw runtime_error("can't open " + filename);
+        }
+        text.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+
+        split_on_char(text, '\n', lines);
+        lines.erase(remove_if(lines.begin(), lines.end(),
+                              [](const string_view line) { return line.empty() or line.front() == '#'; }),
+                    lines.end());
+
+        vector<string_view> fields, measurement_tag_set_fields, field_key_value;
+        string_view last_series, last_timestamp;
+        for (const string_view line : lines) {
+            split_on_char(line, ' ', fields);
+            if (fields.size() != 3) {
+                continue;
+            }
+            const auto [measurement_tag_set, field_set, timestamp] = tie(fields[0], fields[1], fields[2]);
+            split_on_char(measurement_tag_set, ',', measurement_tag_set_fields);
+            const optional<Measurement> measurement = measurements.lookup(measurement_tag_set_fields[0]);
+            split_on_char(field_set, '=', field_key_value);
+            if (not measurement or field_key_value.size() != 2) {
+                continue;
+            }
+            const auto [key, value] = tie(field_key_value[0], field_key_value[1]);
+
+            timestamps.push_back(timestamp);
+            if (value.front() == '"') {
+                if (key == "user"sv) {
+                    usernames.push_back(influx_username(value));
+                }
+            } else if (value.back() == 'i') {
+                integers.push_back(value);
+            } else {
+                floats.push_back(value);
+            }
+
+            vector<BenchRecord> & measurement_records = records[uint8_t(*measurement)];
+            if (measurement_records.empty() or measurement_tag_set != last_series or timestamp != last_timestamp) {
+                measurement_records.push_back({*measurement, {}});
+            }
+            measurement_records.back().fields.emplace_back(key, value);
+            n_fields[uint8_t(*measurement)]++;
+            last_series = measurement_tag_set;
+            last_timestamp = timestamp;
+        }
+    }
+};
+
+void bench_main(const string & experiment_dump_filename, const Day_ns start_ts,
+                const string & export_filename, const string & filter) {
+    Corpus corpus{export_filename};
+    const BenchRunner bench{filter};
+    const size_t n_lines = corpus.lines.size();
+
+    {
+        vector<string_view> fields;
+        bench.run("split_on_char", n_lines, n_lines, [&] {
+            for (const string_view line : corpus.lines) {
+                split_on_char(line, ' ', fields);
+                do_not_optimize(fields.size());
+            }
+        });
+    }
+
+    bench.run("to_uint64 (timestamp)", corpus.timestamps.size(), 0, [&] {
+        for (const string_view timestamp : corpus.timestamps) {
+            do_not_optimize(to_uint64(timestamp));
+        }
+    });
+
+    bench.run("to_double (float field)", corpus.floats.size(), 0, [&] {
+        for (const string_view value : corpus.floats) {
+            do_not_optimize(to_double(value));
+        }
+    });
+
+    bench.run("influx_integer<uint32_t>", corpus.integers.size(), 0, [&] {
+        for (const string_view value : corpus.integers) {
+            do_not_optimize(influx_integer<uint32_t>(value));
+        }
+    });
+
+    {
+        string_table usernames, browsers, ostable;
+
+        bench.run("string_table::forward_map_vivify", corpus.usernames.size(), 0, [&] {
+            for (const string_view username : corpus.usernames) {
+                do_not_optimize(usernames.forward_map_vivify(username));
+            }
+        });
+
+        const uint8_t client_buffer = uint8_t(Measurement::client_buffer);
+        bench.run("Event::insert_unique", corpus.n_fields[client_buffer], 0, [&] {
+            for (const BenchRecord & record : corpus.records[client_buffer]) {
+                Event event;
+                for (const auto & [key, value] : record.fields) {
+                    event.insert_unique(key, value, usernames);
+                }
+                do_not_optimize(event);
+            }
+        });
+
+        const uint8_t client_sysinfo = uint8_t(Measurement::client_sysinfo);
+        bench.run("Sysinfo::insert_unique", corpus.n_fields[client_sysinfo], 0, [&] {
+            for (const BenchRecord & record : corpus.records[client_sysinfo]) {
+                Sysinfo sysinfo;
+                for (const auto & [key, value] : record.fields) {
+                    sysinfo.insert_unique(key, value, usernames, browsers, ostable);
+                }
+                do_not_optimize(sysinfo);
+            }
+        });
+
+        const uint8_t video_sent = uint8_t(Measurement::video_sent);
+        bench.run("VideoSent::insert_unique", corpus.n_fields[video_sent], 0, [&] {
+            for (const BenchRecord & record : corpus.records[video_sent]) {
+                VideoSent videosent;
+                for (const auto & [key, value] : record.fields) {
+                    videosent.insert_unique(key, value, usernames);
+                }
+                do_not_optimize(videosent);
+            }
+        });
+    }
+
+    Parser parser{experiment_dump_filename, start_ts};
+
+    // the whole of parsing, for comparison with its kernels
+    bench.run("Parser::parse_stdin", n_lines, n_lines, [&] {
+        parser.start_day(start_ts);
+        LineReader reader{export_filename};
+        parser.parse_stdin(reader);
+    });
+
+    {
+        // parse again, in case parse_stdin's benchmark was filtered out
+        QuietStderr quiet;
+        parser.start_day(start_ts);
+        LineReader reader{export_filename};
+        parser.parse_stdin(reader);
+        parser.accumulate_sessions();
+        parser.accumulate_video_sents();
+    }
+    const vector<ParserBench::Stream> streams = ParserBench::streams(parser);
+    if (streams.empty()) {
+        throw runtime_error(export_filename + " has no streams on this day");
+    }
+
+    bench.run("Parser::summarize (per stream)", streams.size(), 0, [&] {
+        for (const ParserBench::Stream & stream : streams) {
+            do_not_optimize(ParserBench::summarize(parser, stream).time_extent);
+        }
+    });
+
+    bench.run("Parser::video_summarize (per stream)", streams.size(), 0, [&] {
+        for (const ParserBench::Stream & stream : streams) {
+            do_not_optimize(ParserBench::video_summarize(parser, stream));
+        }
+    });
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        if (argc <= 0) {
+            abort();
+        }
+
+        if (argc != 4 and argc != 5) {
+            cerr << "Usage: " << argv[0] << " expt_dump date export [benchmark]\n"
+                    "e.g. " << argv[0] << " experiments/puffer.expt_jan9_2020 2020-01-10T11_2020-01-11T11 bench/export.txt\n"
+                    "benchmark: run only benchmarks whose name contains this\n";
+            return EXIT_FAILURE;
+        }
+
+        const optional<Day_ns> start_ts = parse_date(argv[2]);
+        if (not start_ts) {
+            cerr << "Date argument could not be parsed; format as 2019-07-01T11_2019-07-02T11\n";
+            return EXIT_FAILURE;
+        }
+
+        bench_main(argv[1], start_ts.value(), argv[3], argc == 5 ? argv[4] : "");
+    } catch (const exception & e) {
+        cerr << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,155 @@
+/* Microbenchmarks of confinterval's kernels over a fixed input: bench/stats.txt, 3000 lines of analyze
+ * output for the four schemes and one day of bench/intersection.txt. "make bench" runs it.
+ * It also checks that the bootstrap's kernels draw realizations from the same distribution. */
+
+#define CONFINTERVAL_NO_MAIN
+#include "confinterval.cc"
+
+#include <bench.hh>
+#include <sstream>
+
+/* Statistics' samples, for the benchmarks */
+class StatisticsBench {
+    public:
+    static const vector<double> & all_watch_times(const Statistics & stats) { return stats.all_watch_times; }
+    static const map<string, SchemeStats> & scheme_stats(const Statistics & stats) { return stats.scheme_stats; }
+
+    /* Forget the samples read by parse_stdin, keeping the schemes and days */
+    static void clear_samples(Statistics & stats) {
+        stats.all_watch_times.clear();
+        for (auto & [scheme, scheme_stats] : stats.scheme_stats) {
+            scheme_stats = SchemeStats{};
+        }
+    }
+};
+
+/* Two-sample Kolmogorov-Smirnov statistic: the largest difference between the empirical CDFs of a and b */
+double ks_statistic(vector<double> a, vector<double> b) {
+    sort(a.begin(), a.end());
+    sort(b.begin(), b.end());
+    double d = 0;
+    size_t i = 0, j = 0;
+    while (i < a.size() and j < b.size()) {
+        const double x = min(a[i], b[j]);
+        while (i < a.size() and a[i] == x) { i++; }
+        while (j < b.size() and b[j] == x) { j++; }
+        d = max(d, abs(double(i) / a.size() - double(j) / b.size()));
+    }
+    return d;
+}
+
+void bench_main(const string & intersection_filename, const string & stats_filename, const string & filter) {
+    ifstream file{stats_filename};
+    if (not file.is_open()) {
+        throw runtime_error("can't open " + stats_filename);
+    }
+    const string text{istreambuf_iterator<char>(file), istreambuf_iterator<char>()};
+    const size_t n_lines = count(text.begin(), text.end(), '\n');
+
+    const BenchRunner bench{filter};
+    Statistics stats = [&] {
+        QuietStderr quiet;
+        return Statistics{intersection_filename};
+    }();
+
+    // before parse_stdin does, so it doesn't replace cin's buffer
+    ios::sync_with_stdio(false);
+    bench.run("Statistics::parse_stdin", n_lines, n_lines, [&] {
+        StatisticsBench::clear_samples(stats);
+        istringstream input{text};
+        streambuf * const stdin_buf = cin.rdbuf(input.rdbuf());
+        cin.clear();
+        stats.parse_stdin(false);
+        cin.rdbuf(stdin_buf);
+    });
+    if (StatisticsBench::all_watch_times(stats).empty()) {
+        // parse_stdin's benchmark was filtered out; parse once for the others
+        QuietStderr quiet;
+        istringstream input{text};
+        streambuf * const stdin_buf = cin.rdbuf(input.rdbuf());
+        cin.clear();
+        stats.parse_stdin(false);
+        cin.rdbuf(stdin_buf);
+    }
+
+    const vector<double> & all_watch_times = StatisticsBench::all_watch_times(stats);
+    if (all_watch_times.empty()) {
+        throw runtime_error(stats_filename + " has no streams on the days of " + intersection_filename);
+    }
+
+    Statistics::Prng prng{0, 0, 0};
+    constexpr unsigned int SIMULATIONS = 10000;
+    const WatchTimeBins watch_time_bins{all_watch_times};
+
+    bench.run("PhiloxStream::below (watch time index)", SIMULATIONS, 0, [&] {
+        for (unsigned int i = 0; i < SIMULATIONS; i++) {
+            do_not_optimize(prng.below(all_watch_times.size()));
+        }
+    });
+    {
+        // the generator and distribution the bootstrap drew indices with before, for comparison
+        mt19937_64 mt{0};
+        uniform_int_distribution<size_t> index{0, all_watch_times.size() - 1};
+        bench.run("mt19937_64 + uniform_int_distribution (watch time index)", SIMULATIONS, 0, [&] {
+            for (unsigned int i = 0; i < SIMULATIONS; i++) {
+                do_not_optimize(index(mt));
+            }
+        });
+    }
+    for (const auto & [scheme, scheme_stats] : StatisticsBench::scheme_stats(stats)) {
+        const StallRatioSampler sampler{scheme_stats};
+        bench.run("Statistics::simulate (" + scheme + ")", SIMULATIONS, 0, [&] {
+            for (unsigned int i = 0; i < SIMULATIONS; i++) {
+                do_not_optimize(Statistics::simulate(all_watch_times, prng, sampler).second);
+            }
+        });
+        bench.run("Statistics::simulate_realization (" + scheme + ")", sampler.samples, 0, [&] {
+            do_not_optimize(Statistics::simulate_realization(all_watch_times, prng, sampler));
+        });
+        bench.run("Statistics::simulate_realization_by_bin (" + scheme + ")", sampler.samples, 0, [&] {
+            do_not_optimize(Statistics::simulate_realization_by_bin(watch_time_bins, prng, sampler));
+        });
+
+        /* The kernels' realizations must be drawn from the same distribution: check with a two-sample
+         * Kolmogorov-Smirnov test at alpha = 0.001 (fixed seeds, so the check is repeatable) */
+        const string check = "check: by-bin vs per-session kernel (" + scheme + ")";
+        if (bench.selected(check)) {
+            constexpr unsigned int REALIZATIONS = 2000;
+            vector<double> per_session, by_bin;
+            Statistics::Prng check_prng{1, 0, 0};
+            for (unsigned int i = 0; i < REALIZATIONS; i++) {
+                per_session.push_back(Statistics::simulate_realization(all_watch_times, check_prng, sampler));
+                by_bin.push_back(Statistics::simulate_realization_by_bin(watch_time_bins, check_prng, sampler));
+            }
+            const double d = ks_statistic(per_session, by_bin);
+            const double critical = 1.949 * sqrt(2.0 / REALIZATIONS);
+            cout << left << setw(BenchRunner::NAME_WIDTH) << check << right << setprecision(4) << "KS D=" << d
+                 << " (critical " << critical << ")" << endl;
+            if (d > critical) {
+                throw runtime_error("simulate_realization_by_bin's realizations differ from simulate_realization's");
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        if (argc <= 0) {
+            abort();
+        }
+
+        if (argc != 3 and argc != 4) {
+            cerr << "Usage: " << argv[0] << " intersection_filename stats [benchmark]\n"
+                    "e.g. " << argv[0] << " bench/intersection.txt bench/stats.txt\n"
+                    "benchmark: run only benchmarks whose name contains this\n";
+            return EXIT_FAILURE;
+        }
+
+        bench_main(argv[1], argv[2], argc == 4 ? argv[3] : "");
+    } catch (const exception & e) {
+        cerr << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -11,10 +11,19 @@
 #include <fstream>
 #include <random>
 #include <algorithm>
+#include <numeric>
 #include <iomanip>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <optional>
 #include <getopt.h>
 #include <cassert>
 #include <dateutil.hh>
+#include <split.hh>
+#include <telemetry.hh>
+#include <summarystore.hh>
+#include <philox.hh>
 
 #include <sys/time.h>
 #include <sys/resource.h>
@@ -23,7 +32,8 @@ using namespace std;
 using namespace std::literals;
 
 /** 
- * From stdin, parses output of analyze, which contains one line per stream summary.
+ * From stdin, parses output of analyze, which contains one line per stream summary
+ * (or reads the stores of analyze --columnar, given as arguments).
  * To stdout, outputs each scheme's mean stall ratio, SSIM, and SSIM variance,
  * along with confidence intervals. 
  * Takes as argument the file containing desired schemes and the days they intersect 
@@ -46,26 +56,6 @@ size_t memcheck() {
     return usage.ru_maxrss;
 }
 
-void split_on_char(const string_view str, const char ch_to_find, vector<string_view> & ret) {
-    ret.clear();
-
-    bool in_double_quoted_string = false;
-    unsigned int field_start = 0;
-    for (unsigned int i = 0; i < str.size(); i++) {
-        const char ch = str[i];
-        if (ch == '"') {
-            in_double_quoted_string = !in_double_quoted_string;
-        } else if (in_double_quoted_string) {
-            continue;
-        } else if (ch == ch_to_find) {
-            ret.emplace_back(str.substr(field_start, i - field_start));
-            field_start = i + 1;
-        }
-    }
-
-    ret.emplace_back(str.substr(field_start));
-}
-
 uint64_t to_uint64(string_view str) {
     uint64_t ret = -1;
     const auto [ptr, ignore] = from_chars(str.data(), str.data() + str.size(), ret);
@@ -100,6 +90,35 @@ double to_double(const string_view str) {
     return ret;
 }
 
+/* Run f(t) for t in [0, n_threads), each on its own thread (or this one, if n_threads is 1),
+ * and rethrow the first thread's exception, if any */
+template <class F>
+void run_threads(const unsigned int n_threads, F && f) {
+    if (n_threads == 1) {
+        f(0);
+        return;
+    }
+    vector<exception_ptr> errors(n_threads);
+    vector<thread> threads;
+    for (unsigned int t = 0; t < n_threads; t++) {
+        threads.emplace_back([&, t] {
+            try {
+                f(t);
+            } catch (...) {
+                errors[t] = current_exception();
+            }
+        });
+    }
+    for (auto & th : threads) {
+        th.join();
+    }
+    for (const auto & error : errors) {
+        if (error) {
+            rethrow_exception(error);
+        }
+    }
+}
+
 double raw_ssim_to_db(const double raw_ssim) {
     return -10.0 * log10( 1 - raw_ssim );
 }
@@ -212,7 +231,166 @@ struct SchemeStats {
     }
 };
 
+/**
+ * A scheme's stall ratios, laid out for Statistics::simulate: all bins in one array, bin by bin
+ * (compressed sparse rows), and for each bin, the range of that array to draw from.
+ * That's the bin itself or, if it's empty, its neighbors' (MIN_BIN to MAX_BIN) -- which are
+ * adjacent in the array, so drawing uniformly from both at once is drawing from one range.
+ */
+struct StallRatioSampler {
+    vector<double> stall_ratios{};
+    array<pair<uint32_t, uint32_t>, SchemeStats::MAX_BIN + 1> draw_ranges{};    // [begin, end) by bin
+    unsigned int samples;
+
+    explicit StallRatioSampler(const SchemeStats & scheme) : samples(scheme.samples) {
+        array<uint32_t, SchemeStats::MAX_BIN + 2> bin_starts{};
+        for (unsigned int bin = 0; bin <= SchemeStats::MAX_BIN; bin++) {
+            bin_starts[bin] = stall_ratios.size();
+            const vector<double> & ratios = scheme.binned_stall_ratios.at(bin);
+            stall_ratios.insert(stall_ratios.end(), ratios.begin(), ratios.end());
+        }
+        bin_starts[SchemeStats::MAX_BIN + 1] = stall_ratios.size();
+
+        for (unsigned int bin = SchemeStats::MIN_BIN; bin <= SchemeStats::MAX_BIN; bin++) {
+            if (bin_starts[bin] < bin_starts[bin + 1]) {
+                draw_ranges[bin] = {bin_starts[bin], bin_starts[bin + 1]};
+            } else {
+                const unsigned int left = bin > SchemeStats::MIN_BIN ? bin - 1 : bin;
+                const unsigned int right = bin < SchemeStats::MAX_BIN ? bin + 1 : bin;
+                draw_ranges[bin] = {bin_starts[left], bin_starts[right + 1]};     // empty if both are
+            }
+        }
+    }
+};
+
+/**
+ * all_watch_times grouped by watch time bin (CSR, as in StallRatioSampler), for
+ * Statistics::simulate_realization_by_bin: each bin's watch times are together, in input order.
+ */
+struct WatchTimeBins {
+    vector<double> watch_times{};
+    array<uint32_t, SchemeStats::MAX_BIN + 2> bin_starts{};
+
+    explicit WatchTimeBins(const vector<double> & all_watch_times) : watch_times(all_watch_times.size()) {
+        array<uint32_t, SchemeStats::MAX_BIN + 1> counts{};
+        for (const double watch_time : all_watch_times) {
+            counts[SchemeStats::watch_time_bin(watch_time)]++;
+        }
+        for (unsigned int bin = 0; bin <= SchemeStats::MAX_BIN; bin++) {
+            bin_starts[bin + 1] = bin_starts[bin] + counts[bin];
+        }
+        array<uint32_t, SchemeStats::MAX_BIN + 1> next = {};
+        copy_n(bin_starts.begin(), next.size(), next.begin());
+        for (const double watch_time : all_watch_times) {
+            watch_times[next[SchemeStats::watch_time_bin(watch_time)]++] = watch_time;
+        }
+    }
+};
+
+/**
+ * Streaming estimate of the p-quantile of the values added so far, in constant space: the P-squared
+ * algorithm (Jain and Chlamtac, CACM 1985). Five markers track the minimum, p/2, p, (1+p)/2 quantiles
+ * and maximum; each value moves the markers' positions, and a marker that falls a position behind
+ * or ahead of where it should be is moved, and its height adjusted by piecewise-parabolic interpolation.
+ */
+class P2Quantile {
+    double p_;
+    array<double, 5> heights_{};
+    array<double, 5> positions_{0, 1, 2, 3, 4};
+    array<double, 5> desired_{};
+    array<double, 5> increments_{};
+    size_t count_ = 0;
+
+    double parabolic(const unsigned int i, const double d) const {
+        const auto & q = heights_;
+        const auto & n = positions_;
+        return q[i] + d / (n[i + 1] - n[i - 1])
+            * ((n[i] - n[i - 1] + d) * (q[i + 1] - q[i]) / (n[i + 1] - n[i])
+               + (n[i + 1] - n[i] - d) * (q[i] - q[i - 1]) / (n[i] - n[i - 1]));
+    }
+
+    double linear(const unsigned int i, const int d) const {
+        return heights_[i] + d * (heights_[i + d] - heights_[i]) / (positions_[i + d] - positions_[i]);
+    }
+
+    public:
+    explicit P2Quantile(const double p)
+        : p_(p), desired_{0, 2 * p, 4 * p, 2 + 2 * p, 4}, increments_{0, p / 2, p, (1 + p) / 2, 1} {}
+
+    void add(const double x) {
+        if (count_ < heights_.size()) {
+            heights_[count_++] = x;
+            if (count_ == heights_.size()) {
+                sort(heights_.begin(), heights_.end());
+            }
+            return;
+        }
+        count_++;
+
+        // the cell the value falls in, widening the extremes if it's outside them
+        unsigned int k;
+        if (x < heights_[0]) {
+            heights_[0] = x;
+            k = 0;
+        } else if (x >= heights_[4]) {
+            heights_[4] = x;
+            k = 3;
+        } else {
+            k = upper_bound(heights_.begin() + 1, heights_.end(), x) - heights_.begin() - 1;
+        }
+        for (unsigned int i = k + 1; i < 5; i++) {
+            positions_[i]++;
+        }
+        for (unsigned int i = 0; i < 5; i++) {
+            desired_[i] += increments_[i];
+        }
+
+        for (unsigned int i = 1; i <= 3; i++) {
+            const double off = desired_[i] - positions_[i];
+            if ((off >= 1 and positions_[i + 1] - positions_[i] > 1)
+                or (off <= -1 and positions_[i - 1] - positions_[i] < -1)) {
+                const int d = off > 0 ? 1 : -1;
+                const double height = parabolic(i, d);
+                heights_[i] = heights_[i - 1] < height and height < heights_[i + 1] ? height : linear(i, d);
+                positions_[i] += d;
+            }
+        }
+    }
+
+    /* Estimate of the quantile (exact until five values have been added) */
+    double estimate() const {
+        if (count_ == 0) {
+            return NAN;
+        }
+        if (count_ < heights_.size()) {
+            array<double, 5> sorted = heights_;
+            sort(sorted.begin(), sorted.begin() + count_);
+            return sorted[size_t(p_ * count_)];   // as Realizations::stats indexes
+        }
+        return heights_[2];
+    }
+};
+
+/* Command-line settings of the bootstrap */
+struct BootstrapOptions {
+    uint64_t seed = 0;
+    unsigned int threads = 1;       // simulating realizations in parallel
+    bool by_bin = false;            // simulate realizations with simulate_realization_by_bin
+
+    /* With adaptive, each scheme's realizations are simulated in rounds of round_iterations, until its
+     * confidence interval's limits (as estimated by P2Quantile) have each moved by at most tolerance
+     * times its width in each of stable_rounds rounds in a row -- but at least min_iterations,
+     * and at most the fixed bootstrap's number */
+    bool adaptive = false;
+    double tolerance = 0.01;
+    unsigned int min_iterations = 2000;
+    unsigned int round_iterations = 500;
+    unsigned int stable_rounds = 3;
+};
+
 class Statistics {
+    friend class StatisticsBench;   // bench_confinterval.cc reads and resets the samples
+
     // list of watch times from which to sample
     vector<double> all_watch_times{};
 
@@ -226,7 +404,19 @@ class Statistics {
     // real (non-simulated) stats 
     map<string, SchemeStats> scheme_stats{};
 
+    // input read by parse_stdin (or read_stores: rows, and bytes of the columns read)
+    size_t n_lines_read = 0;
+    size_t n_bytes_read = 0;
+    size_t n_partitions_read = 0;
+    size_t n_partitions_skipped = 0;
+
+    // with slow_sessions, streams with a higher mean delivery rate (bytes/s) are ignored
+    constexpr static double SLOW_DELIVERY_RATE = 6000000.0 / 8.0;
+
     public:     // TODO: some of this could be private (same in schemedays) 
+    /* Random numbers of a realization: its own Philox stream (see do_point_estimate) */
+    using Prng = PhiloxStream;
+
      Statistics (const string & intersection_filename) {
         vector<string> desired_schemes;
         /* Read file containing desired schemes, and list of days they intersect */
@@ -273,6 +463,19 @@ class Statistics {
         print_intervals(acceptable_days);
      }
 
+    size_t lines_read() const { return n_lines_read; }
+    size_t bytes_read() const { return n_bytes_read; }
+
+    /* Add the input and sample counts to the metrics record */
+    void count_metrics() const {
+        Metrics & metrics = Metrics::get();
+        metrics.count("lines", n_lines_read);
+        metrics.count("bytes", n_bytes_read);
+        metrics.count("watch_times", all_watch_times.size());
+        metrics.count("partitions_read", n_partitions_read);
+        metrics.count("partitions_skipped", n_partitions_skipped);
+    }
+
     /* Indicates whether ts is one of the acceptable days read
      * from the input file */
     bool ts_is_acceptable(uint64_t ts) {
@@ -301,6 +504,8 @@ class Statistics {
 
             getline(cin, line_storage);
             line_no++;
+            n_lines_read++;
+            n_bytes_read += line_storage.size() + 1;
 
             const string_view line{line_storage};
 
@@ -339,7 +544,7 @@ class Statistics {
                     throw runtime_error("field mismatch");
                 }
                 const double delivery_rate = to_double(scratch[1]);
-                if (delivery_rate > (6000000.0/8.0)) {
+                if (delivery_rate > SLOW_DELIVERY_RATE) {
                     continue;
                 }
             }
@@ -387,90 +592,162 @@ class Statistics {
 
             // Record stall ratio, ssim, ssim variation 
             // Ignore if not one of the requested schemes 
-            SchemeStats *the_scheme = nullptr;
             auto found_scheme = scheme_stats.find(string(scheme));
             if (found_scheme != scheme_stats.end()) {
-                the_scheme = &found_scheme->second;
+                record_samples(found_scheme->second, watch_time, stall_time, mean_ssim_val, ssim_variation_db_val);
             }
+        }   // end while
+    }
+
+    /* Record a good stream of a requested scheme */
+    static void record_samples(SchemeStats & the_scheme, const double watch_time, const double stall_time,
+                               const double mean_ssim_val, const double ssim_variation_db_val) {
+        the_scheme.add_sample(watch_time, stall_time);
+        if ( mean_ssim_val >= 0 ) { the_scheme.add_ssim_sample(watch_time, mean_ssim_val); }
+        // SSIM variation = 0 over a whole stream is questionable
+        if ( ssim_variation_db_val > 0 and ssim_variation_db_val <= 10000 ) { the_scheme.add_ssim_variation_sample(ssim_variation_db_val); }
+    }
 
-            if (the_scheme) {
-                the_scheme->add_sample(watch_time, stall_time);
-                if ( mean_ssim_val >= 0 ) { the_scheme->add_ssim_sample(watch_time, mean_ssim_val); }
-                // SSIM variation = 0 over a whole stream is questionable
-                if ( ssim_variation_db_val > 0 and ssim_variation_db_val <= 10000 ) { the_scheme->add_ssim_variation_sample(ssim_variation_db_val); }
+    /* As parse_stdin, from the stores written by analyze --columnar rather than text.
+     * Partitions (days) are skipped unless acceptable, and unless their zone maps admit a stream
+     * that would be counted (watch time of at least 4 s; with slow_sessions, a slow delivery rate).
+     * Of the rest, only the columns used here are read. */
+    void read_stores(const vector<string> & filenames, bool slow_sessions) {
+        using summarystore::Column;
+        vector<uint8_t> good;
+        vector<uint32_t> scheme_ids;
+        vector<double> delivery_rates, watch_times, stall_times, mean_ssims, ssim_variations;
+        vector<SchemeStats *> schemes;      // of a partition, by id: nullptr if not requested
+
+        for (const string & filename : filenames) {
+            const summarystore::File store{filename};
+            for (const summarystore::Partition & partition : store.partitions()) {
+                if (not acceptable_days.count(partition.day)
+                    or not partition.column(Column::total_after_startup).may_overlap(4, INFINITY)
+                    or (slow_sessions and not partition.column(Column::mean_delivery_rate).may_overlap(-INFINITY, SLOW_DELIVERY_RATE))) {
+                    n_partitions_skipped++;
+                    continue;
+                }
+                n_partitions_read++;
+                n_lines_read += partition.n_rows;
+
+                n_bytes_read += store.read_column(partition, Column::good, good);
+                n_bytes_read += store.read_column(partition, Column::scheme, scheme_ids);
+                n_bytes_read += store.read_column(partition, Column::total_after_startup, watch_times);
+                n_bytes_read += store.read_column(partition, Column::stall_after_startup, stall_times);
+                n_bytes_read += store.read_column(partition, Column::mean_ssim, mean_ssims);
+                n_bytes_read += store.read_column(partition, Column::ssim_variation_db, ssim_variations);
+                if (slow_sessions) {
+                    n_bytes_read += store.read_column(partition, Column::mean_delivery_rate, delivery_rates);
+                }
+
+                schemes.clear();
+                for (const string & scheme : partition.schemes()) {
+                    auto found_scheme = scheme_stats.find(scheme);
+                    schemes.push_back(found_scheme != scheme_stats.end() ? &found_scheme->second : nullptr);
+                }
+
+                for (size_t i = 0; i < partition.n_rows; i++) {
+                    if (slow_sessions and delivery_rates[i] > SLOW_DELIVERY_RATE) {
+                        continue;
+                    }
+                    if (watch_times[i] < 4) {
+                        continue;
+                    }
+                    all_watch_times.push_back(watch_times[i]);
+
+                    if (not good[i]) {
+                        continue;
+                    }
+                    if (SchemeStats * the_scheme = schemes.at(scheme_ids[i])) {
+                        record_samples(*the_scheme, watch_times[i], stall_times[i], mean_ssims[i], ssim_variations[i]);
+                    }
+                }
             }
-        }   // end while
+        }
     }
 
     /* Simulate watch and stall time: 
      * Draw a random watch time from all watch times; 
      * draw a stall ratio from the bin corresponding to the simulated watch time, 
      * in the per-scheme stall ratio distribution
-     * representing the input to analyze.
+     * representing the input to analyze
+     * (or, if that bin is empty, from its neighbors together -- see StallRatioSampler).
      */
     static pair<double, double> simulate( const vector<double> & all_watch_times,
-            default_random_engine & prng,
-            const SchemeStats & /* real */scheme ) {
+            Prng & prng,
+            const StallRatioSampler & /* real */scheme ) {
         /* step 1: draw a random watch duration */ 
-        uniform_int_distribution<> possible_watch_time_index(0, all_watch_times.size() - 1); 
-        const double simulated_watch_time = all_watch_times.at(possible_watch_time_index(prng)); 
+        const double simulated_watch_time = all_watch_times[prng.below(all_watch_times.size())];
 
         /* step 2: draw a stall ratio for the scheme from a similar observed watch time */
-        unsigned int simulated_watch_time_binned = SchemeStats::watch_time_bin(simulated_watch_time);
-        size_t num_stall_ratio_samples = scheme.binned_stall_ratios.at(simulated_watch_time_binned).size();
-
-        if (num_stall_ratio_samples > 0) {  
-            // scheme has nonempty bin corresponding to the simulated watch time => 
-            // draw stall ratio from that bin
-            uniform_int_distribution<> possible_stall_ratio_index(0, num_stall_ratio_samples - 1);
-            const double simulated_stall_time = simulated_watch_time * scheme.binned_stall_ratios.at(simulated_watch_time_binned).at(possible_stall_ratio_index(prng));
-
-            return {simulated_watch_time, simulated_stall_time};
-        } else {
-            if (simulated_watch_time_binned == 0) { // watch_time_bin already throws if bin < 2
-                throw runtime_error("no small session stall_ratios?");
-            }
-            
-            /* If simulated bin is empty, draw from aggregate over left and right bins; throw if both empty */
-            const size_t left_num_stall_ratio_samples = simulated_watch_time_binned > scheme.MIN_BIN ? 
-                                                        scheme.binned_stall_ratios.at(simulated_watch_time_binned - 1).size() 
-                                                        : 0;
-            const size_t right_num_stall_ratio_samples = simulated_watch_time_binned < scheme.MAX_BIN ? 
-                                                        scheme.binned_stall_ratios.at(simulated_watch_time_binned + 1).size() 
-                                                        : 0;
-            if (left_num_stall_ratio_samples == 0 && right_num_stall_ratio_samples == 0) {
-                throw runtime_error("no nonempty bins from which to draw stall_ratio");
-            }
-
-            uniform_int_distribution<> agg_possible_stall_ratio_index(0, left_num_stall_ratio_samples + right_num_stall_ratio_samples - 1); 
-            const unsigned agg_stall_ratio_index = agg_possible_stall_ratio_index(prng);
-            unsigned stall_ratio_index;   // index relative to nsamples in chosen bin
-            if (agg_stall_ratio_index >= left_num_stall_ratio_samples) {    // right bin
-                simulated_watch_time_binned++;
-                stall_ratio_index = agg_stall_ratio_index - left_num_stall_ratio_samples;
-            } else {                                                        // left bin
-                simulated_watch_time_binned--; 
-                stall_ratio_index = agg_stall_ratio_index;
-            }
-            const double simulated_stall_time = simulated_watch_time * scheme.binned_stall_ratios.at(simulated_watch_time_binned).at(stall_ratio_index);
-
-            return {simulated_watch_time, simulated_stall_time};
+        const auto [begin, end] = scheme.draw_ranges[SchemeStats::watch_time_bin(simulated_watch_time)];
+        if (begin == end) {
+            throw runtime_error("no nonempty bins from which to draw stall_ratio");
         }
+        const double simulated_stall_time = simulated_watch_time * scheme.stall_ratios[begin + prng.below(end - begin)];
+
+        return {simulated_watch_time, simulated_stall_time};
     }
 
     /* For each sample in (real) scheme, take a simulated sample 
      * Return resulting simulated total stall ratio */
     static double simulate_realization( const vector<double> & all_watch_times,
-            default_random_engine & prng,
-            const SchemeStats & /* real */scheme ) {
-        SchemeStats scheme_simulated;
+            Prng & prng,
+            const StallRatioSampler & /* real */scheme ) {
+        double total_watch_time = 0;
+        double total_stall_time = 0;
 
         for ( unsigned int i = 0; i < scheme.samples; i++ ) {
             const auto [watch_time, stall_time] = simulate(all_watch_times, prng, scheme);
-            scheme_simulated.add_sample(watch_time, stall_time);	    
+            total_watch_time += watch_time;
+            total_stall_time += stall_time;
         }
 
-        return scheme_simulated.observed_stall_ratio();
+        return total_stall_time / total_watch_time;
+    }
+
+    /* As simulate_realization, but rather than drawing each simulated session's watch time from
+     * all of them, draw how many sessions fall in each watch time bin (one multinomial draw, as
+     * a binomial draw per bin), and then each bin's sessions from that bin's watch times and
+     * stall ratios -- the same distribution, sampled bin by bin from small, cache-resident ranges.
+     * (Not the same draws as simulate_realization, so not the same output for a given seed.) */
+    static double simulate_realization_by_bin( const WatchTimeBins & watch_time_bins,
+            Prng & prng,
+            const StallRatioSampler & /* real */scheme ) {
+        double total_watch_time = 0;
+        double total_stall_time = 0;
+
+        unsigned int sessions_left = scheme.samples;
+        size_t watch_times_left = watch_time_bins.watch_times.size();
+        for (unsigned int bin = SchemeStats::MIN_BIN; bin <= SchemeStats::MAX_BIN and sessions_left > 0; bin++) {
+            const uint32_t watch_begin = watch_time_bins.bin_starts[bin];
+            const uint32_t watch_count = watch_time_bins.bin_starts[bin + 1] - watch_begin;
+            if (watch_count == 0) {
+                continue;
+            }
+            // sessions in this bin, given those in the bins before it
+            const unsigned int sessions = watch_count == watch_times_left ? sessions_left
+                : binomial_distribution<unsigned int>{sessions_left, double(watch_count) / watch_times_left}(prng);
+            sessions_left -= sessions;
+            watch_times_left -= watch_count;
+            if (sessions == 0) {
+                continue;
+            }
+
+            const auto [ratio_begin, ratio_end] = scheme.draw_ranges[bin];
+            if (ratio_begin == ratio_end) {
+                throw runtime_error("no nonempty bins from which to draw stall_ratio");
+            }
+            const uint32_t ratio_count = ratio_end - ratio_begin;
+            for (unsigned int i = 0; i < sessions; i++) {
+                const double watch_time = watch_time_bins.watch_times[watch_begin + prng.below(watch_count)];
+                total_watch_time += watch_time;
+                total_stall_time += watch_time * scheme.stall_ratios[ratio_begin + prng.below(ratio_count)];
+            }
+        }
+
+        return total_stall_time / total_watch_time;
     }
 
     class Realizations {
@@ -479,15 +756,42 @@ class Statistics {
         vector<double> _stall_ratios{};
         // real (non-simulated) stats
         SchemeStats _scheme_sample;
+        // ... and its stall ratios, as simulate draws them
+        StallRatioSampler _sampler;
+        // streaming estimates of the confidence interval's limits, over realizations [0, _n_tracked)
+        P2Quantile _lower_estimate{.025}, _upper_estimate{.975};
+        size_t _n_tracked = 0;
 
         public:
-        Realizations( const string & name, const SchemeStats & scheme_sample ) : _name(name), _scheme_sample(scheme_sample) {}
+        Realizations( const string & name, const SchemeStats & scheme_sample, const size_t iteration_count )
+            : _name(name), _stall_ratios(iteration_count), _scheme_sample(scheme_sample), _sampler(scheme_sample) {}
+
+        /* Simulate realization i (realizations may be simulated in any order, from any thread),
+         * by bin if given watch_time_bins */
+        void add_realization( const size_t i, const vector<double> & all_watch_times,
+                const WatchTimeBins * watch_time_bins, Prng & prng ) {
+            _stall_ratios.at(i) = watch_time_bins   // pass in real stats
+                ? simulate_realization_by_bin(*watch_time_bins, prng, _sampler)
+                : simulate_realization(all_watch_times, prng, _sampler);
+        }
 
-        void add_realization( const vector<double> & all_watch_times,
-                default_random_engine & prng ) {
-            _stall_ratios.push_back(simulate_realization(all_watch_times, prng, _scheme_sample));   // pass in real stats
+        /* Add realizations [_n_tracked, n), all simulated by now, to the estimates of the confidence
+         * interval's limits; return the estimates */
+        pair<double, double> track( const size_t n ) {
+            for (; _n_tracked < n; _n_tracked++) {
+                _lower_estimate.add(_stall_ratios.at(_n_tracked));
+                _upper_estimate.add(_stall_ratios.at(_n_tracked));
+            }
+            return {_lower_estimate.estimate(), _upper_estimate.estimate()};
+        }
+
+        /* Keep only realizations [0, n), if the bootstrap stopped before simulating the rest */
+        void truncate( const size_t n ) {
+            _stall_ratios.resize(n);
         }
 
+        const string & name() const { return _name; }
+
         // mean and 95% confidence interval of *simulated* stall ratios
         tuple<double, double, double> stats() {
             sort(_stall_ratios.begin(), _stall_ratios.end());
@@ -519,28 +823,89 @@ class Statistics {
         }
     };
 
+    /* Simulate iterations [begin, end) of the schemes active (indices into realizations)
+     * on options.threads threads, each taking the next (iteration, scheme) in turn */
+    void simulate_iterations( const BootstrapOptions & options, const WatchTimeBins * watch_time_bins,
+            vector<Realizations> & realizations, const vector<size_t> & active,
+            const size_t begin, const size_t end, const size_t iteration_count ) const {
+        const size_t n_items = (end - begin) * active.size();
+        atomic<size_t> next_item{0};
+        run_threads(options.threads, [&](const unsigned int t) {
+            try {
+                for (size_t item = next_item++; item < n_items; item = next_item++) {
+                    const size_t i = begin + item / active.size(), scheme = active[item % active.size()];
+                    if (t == 0 and item % active.size() == 0 and i % 10 == 0) {
+                        cerr << "\rsample " << i << "/" << iteration_count << "                    ";
+                    }
+
+                    Prng prng{options.seed, uint32_t(i), uint32_t(scheme)};
+                    realizations[scheme].add_realization(i, all_watch_times, watch_time_bins, prng);
+                }
+            } catch (...) {
+                next_item = n_items;    // stop the other threads
+                throw;
+            }
+        });
+        Metrics::get().count("realizations", n_items);
+    }
+
     /* For each scheme: simulate stall ratios, and calculate stall ratio mean/CI over simulated samples.
-     * Calculate SSIM and SSIMvar mean/CI over real samples. */
-    void do_point_estimate() {
-        random_device rd;
-        default_random_engine prng(rd());
+     * Calculate SSIM and SSIMvar mean/CI over real samples.
+     * Each realization draws from its own Philox stream, (iteration, scheme) under the seed, so the
+     * output depends only on the seed (and kernel) -- not on the number of threads, or which thread
+     * took what -- and any one realization can be reproduced on its own.
+     * With options.adaptive, a scheme whose interval has settled stops early (see BootstrapOptions):
+     * its realizations are then the first of those the fixed bootstrap would simulate. */
+    void do_point_estimate(const BootstrapOptions & options) {
+        const optional<WatchTimeBins> watch_time_bins = options.by_bin
+            ? make_optional<WatchTimeBins>(all_watch_times) : nullopt;
 
         // initialize with real stats, from which to sample
         constexpr unsigned int iteration_count = 10000;
         vector<Realizations> realizations;
         for (const auto & [desired_scheme, desired_scheme_stats] : scheme_stats) {
-            realizations.emplace_back(Realizations{desired_scheme, desired_scheme_stats});
+            realizations.emplace_back(Realizations{desired_scheme, desired_scheme_stats, iteration_count});
         }
 
-        /* For each scheme, take 10000 simulated stall ratios */
-        for (unsigned int i = 0; i < iteration_count; i++) {
-            if (i % 10 == 0) {
-                cerr << "\rsample " << i << "/" << iteration_count << "                    ";
+        /* For each scheme, take 10000 simulated stall ratios (or, adaptively, fewer) */
+        vector<size_t> active(realizations.size());
+        iota(active.begin(), active.end(), 0);
+        vector<pair<double, double>> last_limits(realizations.size(), {NAN, NAN});
+        vector<unsigned int> stable_rounds(realizations.size());
+        for (size_t done = 0; done < iteration_count and not active.empty(); ) {
+            const size_t end = options.adaptive ? min<size_t>(done + options.round_iterations, iteration_count)
+                                                : iteration_count;
+            simulate_iterations(options, watch_time_bins ? &*watch_time_bins : nullptr,
+                                realizations, active, done, end, iteration_count);
+            done = end;
+            if (not options.adaptive) {
+                continue;
             }
 
-            for (auto & realization : realizations) {
-                realization.add_realization(all_watch_times, prng);
+            vector<size_t> still_active;
+            for (const size_t scheme : active) {
+                const auto [lower, upper] = realizations[scheme].track(done);
+                const auto [last_lower, last_upper] = last_limits[scheme];
+                const double allowed = options.tolerance * (upper - lower);
+                // (false while last_limits are NaN, before the first round)
+                if (abs(lower - last_lower) <= allowed and abs(upper - last_upper) <= allowed) {
+                    stable_rounds[scheme]++;
+                } else {
+                    stable_rounds[scheme] = 0;
+                }
+                last_limits[scheme] = {lower, upper};
+
+                if (stable_rounds[scheme] >= options.stable_rounds and done >= options.min_iterations
+                        and done < iteration_count) {
+                    realizations[scheme].truncate(done);
+                    cerr << "\n" << realizations[scheme].name() << ": interval settled after "
+                         << done << " realizations\n";
+                    Metrics::get().count("schemes_stopped_early", 1);
+                } else {
+                    still_active.push_back(scheme);
+                }
             }
+            active = move(still_active);
         }
         cerr << "\n";
 
@@ -554,20 +919,51 @@ class Statistics {
     }
 };
 
-void confint_main(const string & intersection_filename, bool slow_sessions) {
+/* Read analyze output from stdin, or from stores if any (analyze --columnar) */
+void confint_main(const string & intersection_filename, bool slow_sessions, const vector<string> & stores,
+                  const BootstrapOptions & options) {
     Statistics stats {  intersection_filename };
-    stats.parse_stdin(slow_sessions);
-    stats.do_point_estimate(); 
+    if (stores.empty()) {
+        MetricsPhase phase{"parse_stdin"};
+        stats.parse_stdin(slow_sessions);
+        phase.add_input(stats.lines_read(), stats.bytes_read());
+    } else {
+        MetricsPhase phase{"read_stores"};
+        stats.read_stores(stores, slow_sessions);
+        phase.add_input(stats.lines_read(), stats.bytes_read());
+    }
+    stats.count_metrics();
+    {
+        MetricsPhase phase{"bootstrap"};
+        stats.do_point_estimate(options); 
+    }
 }
 
+#ifndef CONFINTERVAL_NO_MAIN    // bench_confinterval.cc includes this file for its kernels
+
 void print_usage(const string & program) {
-    cerr << "Usage: " << program << " --scheme-intersection <intersection_filename> --session-speed <session_speed>\n" 
+    cerr << "Usage: " << program << " --scheme-intersection <intersection_filename> --session-speed <session_speed>\n"
+            "       [--threads <n>] [--seed <seed>] [--by-bin]\n"
+            "       [--adaptive [--tolerance <fraction>] [--min-iterations <n>]] [store...]\n"
             "intersection_filename: Output of schemedays --intersect-schemes --intersect-outfile, "
             "containing desired schemes and the days they intersect.\n"
-            "session_speed: slow or all\n";
+            "session_speed: slow or all\n"
+            "--threads: number of threads simulating the bootstrap's realizations (default 1)\n"
+            "--seed: seed of the bootstrap's random numbers (default: random, and printed to stderr);\n"
+            "        output for a given seed is the same with any number of threads\n"
+            "--by-bin: simulate each realization by drawing how many sessions fall in each watch time bin,\n"
+            "          then drawing within bins (the same distribution as the default, drawing each session\n"
+            "          from all watch times, but faster with many watch times; different output for a seed)\n"
+            "--adaptive: stop simulating a scheme's realizations (in rounds of 500, at most 10000) once its\n"
+            "            95% CI's limits have each moved by at most --tolerance times its width (default 0.01)\n"
+            "            in 3 rounds in a row, and at least --min-iterations have been simulated (default 2000)\n"
+            "store: output of analyze --columnar, read instead of analyze's text output from stdin\n"
+            "PUFFER_METRICS=<file> in the environment: write per-phase timings, RSS and counts as JSON to file\n";
 }
 
 int main(int argc, char *argv[]) {
+   Metrics & metrics = Metrics::get();
+   metrics.set_program("confinterval");
    try {
         if (argc < 1) {
             abort();
@@ -575,13 +971,21 @@ int main(int argc, char *argv[]) {
         const option opts[] = {
             {"scheme-intersection", required_argument, nullptr, 'i'},
             {"session-speed", required_argument, nullptr, 's'},
+            {"threads", required_argument, nullptr, 't'},
+            {"seed", required_argument, nullptr, 'r'},
+            {"by-bin", no_argument, nullptr, 'b'},
+            {"adaptive", no_argument, nullptr, 'a'},
+            {"tolerance", required_argument, nullptr, 'e'},
+            {"min-iterations", required_argument, nullptr, 'm'},
             {nullptr, 0, nullptr, 0}
         };
         string intersection_filename;
         string session_speed;
+        BootstrapOptions options;
+        optional<uint64_t> seed;
 
         while (true) {
-            const int opt = getopt_long(argc, argv, "i:s:", opts, nullptr);
+            const int opt = getopt_long(argc, argv, "i:s:t:r:bae:m:", opts, nullptr);
             if (opt == -1) break;
             switch (opt) {
                 case 'i': 
@@ -590,16 +994,40 @@ int main(int argc, char *argv[]) {
                 case 's':
                     session_speed = optarg;
                     break;
+                case 't': {
+                    const int threads = atoi(optarg);
+                    if (threads < 1) {
+                        cerr << "Error: --threads must be at least 1\n";
+                        return EXIT_FAILURE;
+                    }
+                    options.threads = threads;
+                    break;
+                }
+                case 'r':
+                    seed = to_uint64(optarg);
+                    break;
+                case 'b':
+                    options.by_bin = true;
+                    break;
+                case 'a':
+                    options.adaptive = true;
+                    break;
+                case 'e':
+                    options.tolerance = to_double(optarg);
+                    if (not (options.tolerance > 0)) {
+                        cerr << "Error: --tolerance must be positive\n";
+                        return EXIT_FAILURE;
+                    }
+                    break;
+                case 'm':
+                    options.min_iterations = to_uint64(optarg);
+                    break;
                 default:
                     print_usage(argv[0]);
                     return EXIT_FAILURE;
             }
         }
 
-        if (optind != argc) {
-            print_usage(argv[0]);
-            return EXIT_FAILURE;
-        }
         if (intersection_filename.empty() or (session_speed != "slow" and session_speed != "all")) {
             cerr << "Error: Scheme days file and session speed (slow or all) are required\n";
             print_usage(argv[0]);
@@ -607,12 +1035,24 @@ int main(int argc, char *argv[]) {
         }
 
         bool slow_sessions = session_speed == "slow";
-        confint_main(intersection_filename, slow_sessions); 
+        const vector<string> stores(argv + optind, argv + argc);
+        if (not seed) {
+            random_device rd;
+            seed = uint64_t(rd()) << 32 | rd();
+        }
+        cerr << "seed " << *seed << "\n";
+        options.seed = *seed;
+        confint_main(intersection_filename, slow_sessions, stores, options); 
         
     } catch (const exception & e) {
         cerr << e.what() << "\n";
+        metrics.set_error(e.what());
+        metrics.write();
         return EXIT_FAILURE;
     }
 
+    metrics.write();
     return EXIT_SUCCESS;
 }
+
+#endif
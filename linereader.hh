@@ -0,0 +1,186 @@
+/* Block-buffered line reader, useful for analyze (or any tool reading line-oriented input). */
+
+#ifndef LINEREADER_HH
+#define LINEREADER_HH
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * Hands out lines as string_views directly into its own buffer, so lines are never copied.
+ * Reads from a pipe (e.g. stdin) in large blocks; if given a regular file, mmaps it instead.
+ * A view is valid until the next call to get_line. Views are read-only: the mapping is
+ * never written, and pages already read are released, so memory use doesn't grow with
+ * the size of the export.
+ */
+class LineReader {
+    /* Initial block size; grows if a single line doesn't fit */
+    static constexpr size_t BLOCK_SIZE = 16 * 1024 * 1024;
+    /* mmap mode: drop pages already read once this many bytes have accumulated */
+    static constexpr size_t RELEASE_SIZE = 64 * 1024 * 1024;
+
+    int fd_;
+    bool owns_fd_;
+    bool eof_ = false;
+
+    // mmap mode: whole file is mapped read-only
+    const char * map_ = nullptr;
+    size_t map_size_ = 0;
+    size_t map_pos_ = 0;
+    size_t map_released_ = 0;   // [0, map_released_) is no longer resident
+
+    // block mode: unconsumed data is buffer_[begin_, end_)
+    std::vector<char> buffer_{};
+    size_t begin_ = 0;
+    size_t end_ = 0;
+
+    [[noreturn]] static void throw_errno(const std::string & what) {
+        throw std::runtime_error(what + ": " + strerror(errno));
+    }
+
+    void try_mmap() {
+        struct stat st{};
+        if (fstat(fd_, &st) < 0) {
+            throw_errno("fstat");
+        }
+        if (not S_ISREG(st.st_mode) or st.st_size == 0) {
+            return;     // fall back to block reads
+        }
+        void * map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (map == MAP_FAILED) {
+            return;
+        }
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        map_ = static_cast<const char *>(map);
+        map_size_ = st.st_size;
+    }
+
+    /* Everything before map_pos_ has been consumed (the previous view is now invalid) */
+    void release_consumed() {
+        if (map_pos_ - map_released_ < RELEASE_SIZE) {
+            return;
+        }
+        const size_t page_size = sysconf(_SC_PAGESIZE);
+        const size_t release_end = map_pos_ / page_size * page_size;
+        madvise(const_cast<char *>(map_) + map_released_, release_end - map_released_, MADV_DONTNEED);
+        map_released_ = release_end;
+    }
+
+    bool get_mapped_line(std::string_view & line) {
+        if (map_pos_ >= map_size_) {
+            return false;
+        }
+        release_consumed();
+        const char * start = map_ + map_pos_;
+        const char * newline = static_cast<const char *>(memchr(start, '\n', map_size_ - map_pos_));
+        if (newline) {
+            line = {start, size_t(newline - start)};
+            map_pos_ = newline - map_ + 1;
+        } else {
+            line = {start, map_size_ - map_pos_};
+            map_pos_ = map_size_;
+        }
+        return true;
+    }
+
+    /* Move unconsumed data to front of buffer and read another block after it */
+    void refill() {
+        if (begin_ > 0) {
+            memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+        }
+        if (end_ + 1 >= buffer_.size()) {
+            // a single line longer than the buffer
+            buffer_.resize(buffer_.size() * 2);
+        }
+        const ssize_t bytes_read = read(fd_, buffer_.data() + end_, buffer_.size() - 1 - end_);
+        if (bytes_read < 0) {
+            if (errno == EINTR) {
+                return;
+            }
+            throw_errno("read");
+        }
+        if (bytes_read == 0) {
+            eof_ = true;
+        }
+        end_ += bytes_read;
+    }
+
+    bool get_buffered_line(std::string_view & line) {
+        size_t scan_from = begin_;
+        while (true) {
+            const char * newline = static_cast<const char *>(
+                    memchr(buffer_.data() + scan_from, '\n', end_ - scan_from));
+            if (newline) {
+                const size_t line_end = newline - buffer_.data();
+                line = {buffer_.data() + begin_, line_end - begin_};
+                begin_ = line_end + 1;
+                return true;
+            }
+            if (eof_) {
+                if (begin_ == end_) {
+                    return false;
+                }
+                // unterminated last line
+                line = {buffer_.data() + begin_, end_ - begin_};
+                begin_ = end_;
+                return true;
+            }
+            // line straddles the block boundary: keep its beginning and read more
+            const size_t scanned = end_ - begin_;
+            refill();
+            scan_from = begin_ + scanned;
+        }
+    }
+
+    public:
+    /* Read from stdin */
+    LineReader() : fd_(STDIN_FILENO), owns_fd_(false) {
+        try_mmap();
+        if (not map_) {
+            buffer_.resize(BLOCK_SIZE + 1);
+        }
+    }
+
+    /* Read from the named file (a regular file is mmapped; a pipe is read in blocks) */
+    explicit LineReader(const std::string & filename) : fd_(open(filename.c_str(), O_RDONLY)), owns_fd_(true) {
+        if (fd_ < 0) {
+            throw_errno("open " + filename);
+        }
+        try_mmap();
+        if (not map_) {
+            buffer_.resize(BLOCK_SIZE + 1);
+        }
+    }
+
+    ~LineReader() {
+        if (map_) {
+            munmap(const_cast<char *>(map_), map_size_);
+        }
+        if (owns_fd_) {
+            close(fd_);
+        }
+    }
+
+    LineReader(const LineReader &) = delete;
+    LineReader & operator=(const LineReader &) = delete;
+
+    /* Set line to the next line (without its newline); return false at end of input */
+    bool get_line(std::string_view & line) {
+        return map_ ? get_mapped_line(line) : get_buffered_line(line);
+    }
+
+    bool is_mapped() const { return map_ != nullptr; }
+};
+
+#endif
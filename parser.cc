@@ -14,6 +14,10 @@
 
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <schema.hh>
+#include <split.hh>
+#include <arena.hh>
+#include <telemetry.hh>
 
 using namespace std;
 using namespace std::literals;
@@ -34,26 +38,6 @@ size_t memcheck() {
     return usage.ru_maxrss;
 }
 
-void split_on_char(const string_view str, const char ch_to_find, vector<string_view> & ret) {
-    ret.clear();
-
-    bool in_double_quoted_string = false;
-    unsigned int field_start = 0;
-    for (unsigned int i = 0; i < str.size(); i++) {
-	const char ch = str[i];
-	if (ch == '"') {
-	    in_double_quoted_string = !in_double_quoted_string;
-	} else if (in_double_quoted_string) {
-	    continue;
-	} else if (ch == ch_to_find) {
-	    ret.emplace_back(str.substr(field_start, i - field_start));
-	    field_start = i + 1;
-	}
-    }
-
-    ret.emplace_back(str.substr(field_start));
-}
-
 uint64_t to_uint64(string_view str) {
     uint64_t ret = -1;
     const auto [ptr, ignore] = from_chars(str.data(), str.data() + str.size(), ret);
@@ -118,67 +102,50 @@ uint64_t get_server_id(const vector<string_view> & fields) {
     return server_id;
 }
 
+/* Lookups take a string_view, so finding a username that's already interned allocates nothing;
+ * each new username is copied once into names_. */
 class username_table {
-    uint32_t next_id_ = 0;
+    Arena names_{64 * 1024};
 
-    dense_hash_map<string, uint32_t> forward_{};
-    dense_hash_map<uint32_t, string> reverse_{};
+    dense_hash_map<string_view, uint32_t> forward_{};  // views into names_
+    vector<string_view> reverse_{};                    // indexed by id
 
 public:
     username_table() {
 	forward_.set_empty_key({});
-	reverse_.set_empty_key(-1);
     }
 
-    uint32_t forward_map_vivify(const string & name) {
-	auto ref = forward_.find(name);
-	if (ref == forward_.end()) {	
-	    forward_[name] = next_id_;
-	    reverse_[next_id_] = name;
-	    next_id_++;
-	    ref = forward_.find(name);
+    uint32_t forward_map_vivify(const string_view name) {
+	const auto ref = forward_.find(name);
+	if (ref != forward_.end()) {
+	    return ref->second;
 	}
-	return ref->second;
+	char * const stored = names_.allocate<char>(name.size());
+	memcpy(stored, name.data(), name.size());
+	const uint32_t id = reverse_.size();
+	reverse_.emplace_back(stored, name.size());
+	forward_[reverse_.back()] = id;
+	return id;
     }
 
-    uint32_t forward_map(const string & name) const {
-	auto ref = forward_.find(name);
-	if (ref == forward_.end()) {	
-	    throw runtime_error( "username " + name + " not found");
+    uint32_t forward_map(const string_view name) const {
+	const auto ref = forward_.find(name);
+	if (ref == forward_.end()) {
+	    throw runtime_error( "username " + string(name) + " not found");
 	}
 	return ref->second;
     }
 
-    const string & reverse_map(const uint32_t id) const {
-	auto ref = reverse_.find(id);
-	if (ref == reverse_.end()) {
+    string_view reverse_map(const uint32_t id) const {
+	if (id >= reverse_.size()) {
 	    throw runtime_error( "uid " + to_string(id) + " not found");
 	}
-	return ref->second;
+	return reverse_[id];
     }
 };
 
 struct Event {
-    struct EventType {
-	enum class Type : uint8_t { init, startup, play, timer, rebuffer };
-	Type type;
-
-	EventType(const string_view sv)
-	    : type()
-	{
-	    if (sv == "timer"sv) { type = Type::timer; }
-	    else if (sv == "play"sv) { type = Type::play; }
-	    else if (sv == "rebuffer"sv) { type = Type::rebuffer; }
-	    else if (sv == "init"sv) { type = Type::init; }
-	    else if (sv == "startup"sv) { type = Type::startup; }
-	    else { throw runtime_error( "unknown event type: " + string(sv) ); }
-	}
-
-	operator uint8_t() const { return static_cast<uint8_t>(type); }
-
-	bool operator==(const EventType other) { return type == other.type; }
-	bool operator!=(const EventType other) { return not operator==(other); }
-    };
+    using EventType = ::EventType;
 
     optional<uint32_t> init_id{};
     optional<uint32_t> expt_id{};
@@ -217,59 +184,41 @@ struct Event {
     }
 
     void insert_unique(const string_view key, const string_view value, username_table & usernames ) {
-	if (key == "init_id"sv) {
+	const optional<EventField> field = event_fields.lookup(key);
+	if (not field) {
+	    throw runtime_error( "unknown key: " + string(key) );
+	}
+	switch (*field) {
+	case EventField::init_id:
 	    set_unique( init_id, influx_integer<uint32_t>( value ) );
-	} else if (key == "expt_id"sv) {
+	    break;
+	case EventField::expt_id:
 	    set_unique( expt_id, influx_integer<uint32_t>( value ) );
-	} else if (key == "user"sv) {
+	    break;
+	case EventField::user_id:
 	    if (value.size() <= 2 or value.front() != '"' or value.back() != '"') {
 		throw runtime_error("invalid username string: " + string(value));
 	    }
-	    set_unique( user_id, usernames.forward_map_vivify(string(value.substr(1,value.size()-2))) );
-	} else if (key == "event"sv) {
+	    set_unique( user_id, usernames.forward_map_vivify(value.substr(1,value.size()-2)) );
+	    break;
+	case EventField::type:
 	    set_unique( type, { value.substr(1,value.size()-2) } );
-	} else if (key == "buffer"sv) {
+	    break;
+	case EventField::buffer:
 	    set_unique( buffer, to_float(value) );
-	} else if (key == "cum_rebuf"sv) {
+	    break;
+	case EventField::cum_rebuf:
 	    set_unique( cum_rebuf, to_float(value) );
-	} else {
-	    throw runtime_error( "unknown key: " + string(key) );
+	    break;
+	case EventField::first_init_id:
+	case EventField::none:
+	    break;
 	}
     }
 };
 
 using key_table = map<uint64_t, Event>;
 
-struct Channel {
-    constexpr static uint8_t COUNT = 6;
-
-    enum class ID : uint8_t { cbs, nbc, abc, fox, univision, pbs };
-
-    constexpr static array<string_view, COUNT> names = { "cbs", "nbc", "abc", "fox", "univision", "pbs" };
-
-    ID id;
-
-    constexpr Channel(const string_view sv)
-	: id()
-    {
-	if (sv == "cbs"sv) { id = ID::cbs; }
-	else if (sv == "nbc"sv) { id = ID::nbc; }
-	else if (sv == "abc"sv) { id = ID::abc; }
-	else if (sv == "fox"sv) { id = ID::fox; }
-	else if (sv == "univision"sv) { id = ID::univision; }
-	else if (sv == "pbs"sv) { id = ID::pbs; }
-	else { throw runtime_error( "unknown channel: " + string(sv) ); }
-    }
-
-    constexpr Channel(const uint8_t id_int) : id(static_cast<ID>(id_int)) {}
-
-    operator string_view() const { return names[uint8_t(id)]; }
-    constexpr operator uint8_t() const { return static_cast<uint8_t>(id); }
-
-    bool operator==(const Channel other) { return id == other.id; }
-    bool operator!=(const Channel other) { return not operator==(other); }
-};
-
 Channel get_channel(const vector<string_view> & fields) {
     for (const auto & field : fields) {
 	if (not field.compare(0, 8, "channel="sv)) {
@@ -288,9 +237,12 @@ void parse() {
     array<array<key_table, Channel::COUNT>, SERVER_COUNT> client_buffer;
 
     unsigned int line_no = 0;
+    size_t bytes_read = 0;
 
     vector<string_view> fields, measurement_tag_set_fields, field_key_value;
 
+    optional<MetricsPhase> phase{in_place, "parse"};
+
     while (cin.good()) {
 	if (line_no % 1000000 == 0) {
 	    const size_t rss = memcheck() / 1024;
@@ -299,6 +251,7 @@ void parse() {
 
 	getline(cin, line_storage);
 	line_no++;
+	bytes_read += line_storage.size() + 1;
 
 	const string_view line{line_storage};
 
@@ -338,32 +291,26 @@ void parse() {
 	const auto [key, value] = tie(field_key_value[0], field_key_value[1]);
 
 	try {
-	    if ( measurement == "client_buffer"sv ) {
+	    const optional<Measurement> measurement_id = measurements.lookup(measurement);
+	    if (not measurement_id) {
+		throw runtime_error( "Can't parse: " + string(line) );
+	    }
+	    switch (*measurement_id) {
+	    case Measurement::client_buffer:
 		client_buffer[get_server_id(measurement_tag_set_fields)][get_channel(measurement_tag_set_fields)][timestamp].insert_unique(key, value, usernames);
-	    } else if ( measurement == "active_streams"sv ) {
-		// skip
-	    } else if ( measurement == "backlog"sv ) {
-		// skip
-	    } else if ( measurement == "channel_status"sv ) {
-		// skip
-	    } else if ( measurement == "client_error"sv ) {
-		// skip
-	    } else if ( measurement == "client_sysinfo"sv ) {
+		break;
+	    case Measurement::client_sysinfo:
 		//		client_sysinfo[timestamp].insert_unique(key, value);
-	    } else if ( measurement == "decoder_info"sv ) {
-		// skip
-	    } else if ( measurement == "server_info"sv ) {
-		// skip
-	    } else if ( measurement == "ssim"sv ) {
-		// skip
-	    } else if ( measurement == "video_acked"sv ) {
+		break;
+	    case Measurement::video_acked:
 		//		video_acked[get_server_id(measurement_tag_set_fields)][timestamp].insert_unique(key, value);
-	    } else if ( measurement == "video_sent"sv ) {
+		break;
+	    case Measurement::video_sent:
 		//		video_sent[get_server_id(measurement_tag_set_fields)][timestamp].insert_unique(key, value);
-	    } else if ( measurement == "video_size"sv ) {
+		break;
+	    default:
 		// skip
-	    } else {
-		throw runtime_error( "Can't parse: " + string(line) );
+		break;
 	    }
 	} catch (const exception & e ) {
 	    cerr << "Failure on line: " << line << "\n";
@@ -371,6 +318,9 @@ void parse() {
 	}
     }
 
+    phase->add_input(line_no, bytes_read);
+    phase.emplace("group_sessions");
+
     using session_key = tuple<uint32_t, uint32_t, uint32_t, uint8_t, uint8_t>;
     /*                        init_id,  uid,      expt_id,  server,  channel */
     dense_hash_map<session_key, vector<pair<uint64_t, const Event*>>, boost::hash<session_key>> sessions;
@@ -397,6 +347,8 @@ void parse() {
 	}
     }
 
+    phase.emplace("analyze_sessions");
+
     double total_time = 0;
     double stalled_time = 0;
     unsigned int had_stall = 0;
@@ -414,15 +366,27 @@ void parse() {
     cout << "Out of " << sessions.size() << " sessions, " << had_stall << " had a stall, or " << 100.0 * had_stall / double(sessions.size()) << "%.\n";
     cout << "Memory usage is " << memcheck() / 1024 << " MiB.\n";
     cout << "Bad data points: " << bad_count << "\n";
+
+    Metrics & metrics = Metrics::get();
+    metrics.count("lines", line_no);
+    metrics.count("bytes", bytes_read);
+    metrics.count("sessions", sessions.size());
+    metrics.count("bad_records", bad_count);
 }
 
+/* Set PUFFER_METRICS=<file> in the environment to write per-phase timings, RSS and counts as JSON */
 int main() {
+    Metrics & metrics = Metrics::get();
+    metrics.set_program("parser");
     try {
 	parse();
     } catch (const exception & e) {
 	cerr << e.what() << "\n";
+	metrics.set_error(e.what());
+	metrics.write();
 	return EXIT_FAILURE;
     }
 
+    metrics.write();
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,152 @@
+/* Counter-based random numbers for confinterval's bootstrap: Philox4x32-10, generated 8 blocks at a time
+ * (with AVX2 where the compiler targets it), and a buffered stream of its output with bounded draws. */
+
+#ifndef PHILOX_HH
+#define PHILOX_HH
+
+#include <array>
+#include <limits>
+#include <cstdint>
+#include <cstddef>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/**
+ * Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", SC '11):
+ * a bijection of a 128-bit counter under a 64-bit key, so block n of any stream can be computed
+ * on its own -- no state to carry from one draw to the next, or to seed.
+ * Word 0 of the counter is the block number; words 1 to 3 name the stream.
+ */
+class Philox {
+    constexpr static uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;     // multipliers
+    constexpr static uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85;     // key schedule (Weyl sequence)
+    constexpr static unsigned int ROUNDS = 10;
+
+    public:
+    using Key = std::array<uint32_t, 2>;
+    using Counter = std::array<uint32_t, 4>;
+
+    /* Blocks are generated in groups of this many consecutive block numbers */
+    constexpr static size_t GROUP_BLOCKS = 8;
+    constexpr static size_t GROUP_WORDS = GROUP_BLOCKS * 4;
+
+    static Counter block(Counter ctr, Key key) {
+        for (unsigned int round = 0; round < ROUNDS; round++) {
+            const uint64_t p0 = uint64_t(M0) * ctr[0], p1 = uint64_t(M1) * ctr[2];
+            ctr = {uint32_t(p1 >> 32) ^ ctr[1] ^ key[0], uint32_t(p1),
+                   uint32_t(p0 >> 32) ^ ctr[3] ^ key[1], uint32_t(p0)};
+            key = {key[0] + W0, key[1] + W1};
+        }
+        return ctr;
+    }
+
+    /**
+     * Blocks first_block to first_block + GROUP_BLOCKS - 1 of stream (ctr[1..3]), word-major:
+     * out[8 * j + b] is word j of block first_block + b. Same output with and without AVX2.
+     */
+    static void fill_group(const Counter & stream, const uint32_t first_block, const Key & key,
+                           uint32_t * const out) {
+#ifdef __AVX2__
+        __m256i c0 = _mm256_add_epi32(_mm256_set1_epi32(int(first_block)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        __m256i c1 = _mm256_set1_epi32(int(stream[1]));
+        __m256i c2 = _mm256_set1_epi32(int(stream[2]));
+        __m256i c3 = _mm256_set1_epi32(int(stream[3]));
+        __m256i k0 = _mm256_set1_epi32(int(key[0]));
+        __m256i k1 = _mm256_set1_epi32(int(key[1]));
+        const __m256i m0 = _mm256_set1_epi32(int(M0)), m1 = _mm256_set1_epi32(int(M1));
+        const __m256i w0 = _mm256_set1_epi32(int(W0)), w1 = _mm256_set1_epi32(int(W1));
+
+        /* 32x32 -> 64-bit products of all 8 lanes: even lanes, then odd lanes shifted down */
+        const auto mulhilo = [](const __m256i a, const __m256i m, __m256i & hi, __m256i & lo) {
+            const __m256i even = _mm256_mul_epu32(a, m);
+            const __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), m);
+            lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0b10101010);
+            hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0b10101010);
+        };
+
+        for (unsigned int round = 0; round < ROUNDS; round++) {
+            __m256i hi0, lo0, hi1, lo1;
+            mulhilo(c0, m0, hi0, lo0);
+            mulhilo(c2, m1, hi1, lo1);
+            c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), k0);
+            c1 = lo1;
+            c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), k1);
+            c3 = lo0;
+            k0 = _mm256_add_epi32(k0, w0);
+            k1 = _mm256_add_epi32(k1, w1);
+        }
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), c0);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + GROUP_BLOCKS), c1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 2 * GROUP_BLOCKS), c2);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 3 * GROUP_BLOCKS), c3);
+#else
+        for (uint32_t b = 0; b < GROUP_BLOCKS; b++) {
+            const Counter words = block({first_block + b, stream[1], stream[2], stream[3]}, key);
+            for (unsigned int j = 0; j < 4; j++) {
+                out[GROUP_BLOCKS * j + b] = words[j];
+            }
+        }
+#endif
+    }
+};
+
+/**
+ * One Philox stream, buffered: a uniform random bit generator (for the standard distributions),
+ * refilled BUFFER_WORDS at a time, plus below(n) for indices without a distribution object.
+ */
+class PhiloxStream {
+    constexpr static size_t BUFFER_GROUPS = 8;
+    constexpr static size_t BUFFER_WORDS = BUFFER_GROUPS * Philox::GROUP_WORDS;
+
+    Philox::Key key_;
+    Philox::Counter stream_;
+    uint32_t next_block_ = 0;
+    size_t pos_ = BUFFER_WORDS;
+    std::array<uint32_t, BUFFER_WORDS> buffer_{};
+
+    void refill() {
+        for (size_t group = 0; group < BUFFER_GROUPS; group++) {
+            Philox::fill_group(stream_, next_block_, key_, buffer_.data() + group * Philox::GROUP_WORDS);
+            next_block_ += Philox::GROUP_BLOCKS;
+        }
+        pos_ = 0;
+    }
+
+    public:
+    using result_type = uint32_t;
+
+    /* Stream (a, b, c) under seed */
+    PhiloxStream(const uint64_t seed, const uint32_t a, const uint32_t b, const uint32_t c = 0)
+        : key_{uint32_t(seed), uint32_t(seed >> 32)}, stream_{0, a, b, c} {}
+
+    constexpr static result_type min() { return 0; }
+    constexpr static result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    result_type operator()() {
+        if (pos_ == BUFFER_WORDS) {
+            refill();
+        }
+        return buffer_[pos_++];
+    }
+
+    /**
+     * Uniform in [0, n), n > 0: the high half of a 32x32-bit product, rejecting the few low halves
+     * that would bias it (Lemire, "Fast random integer generation in an interval", 2019) --
+     * a division only in the rare case that the low half falls below n.
+     */
+    uint32_t below(const uint32_t n) {
+        uint64_t product = uint64_t((*this)()) * n;
+        if (uint32_t(product) < n) {
+            const uint32_t threshold = uint32_t(-n) % n;
+            while (uint32_t(product) < threshold) {
+                product = uint64_t((*this)()) * n;
+            }
+        }
+        return uint32_t(product >> 32);
+    }
+};
+
+#endif
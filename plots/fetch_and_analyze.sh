@@ -1,8 +1,13 @@
 #!/bin/bash
 # For provided date ranges, grabs data from gs and runs analyze 
 # Assumed to already be in desired output directory (e.g. called by parallel wrapper)
+# Set PARSE_THREADS to parse each day's data with multiple threads
+# Set USE_INFLUX_EXPORT=1 to analyze influx_inspect export, rather than reading the TSM files directly
 set -e
 
+parse_threads=${PARSE_THREADS:-1}
+use_influx_export=${USE_INFLUX_EXPORT:-0}
+
 # Export and analyze a single day
 single_day_stats() { 
     first_day=$1
@@ -18,11 +23,16 @@ single_day_stats() {
     pushd ${date}
     for f in *.tar.gz; do tar xf "$f"; done
     popd
-    # export to influxDB line protocol file
-    # pass top-level date to influx_inspect
-    # echo "exporting and analyzing"
-    influx_inspect export -datadir $date -waldir /dev/null -out /dev/fd/3 3>&1 1>/dev/null | \
-        ~/puffer-statistics/analyze ~/puffer-statistics/experiments/puffer.expt_feb4_2020 $date > ${date}_stats.txt 2> ${date}_err.txt 
+    # echo "analyzing"
+    if [ "$use_influx_export" = 1 ]; then
+        # export to influxDB line protocol file
+        # pass top-level date to influx_inspect
+        influx_inspect export -datadir $date -waldir /dev/null -out /dev/fd/3 3>&1 1>/dev/null | \
+            ~/puffer-statistics/analyze --parse-threads $parse_threads ~/puffer-statistics/experiments/puffer.expt_feb4_2020 $date > ${date}_stats.txt 2> ${date}_err.txt 
+    else
+        # read puffer/retention32d/*/*.tsm under top-level date
+        ~/puffer-statistics/analyze --parse-threads $parse_threads --tsm $date ~/puffer-statistics/experiments/puffer.expt_feb4_2020 $date > ${date}_stats.txt 2> ${date}_err.txt 
+    fi
     # clean up data, leave stats/err.txt
     rm -rf ${date}
     rm ${date}.tar.gz
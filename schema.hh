@@ -0,0 +1,239 @@
+/* Schema of the Influx export, shared by parser and analyze: measurement names, tag values,
+ * and field keys, each declared once, with lookup tables generated at compile time. */
+
+#ifndef SCHEMA_HH
+#define SCHEMA_HH
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <optional>
+#include <stdexcept>
+#include <cstdint>
+
+template <class Enum>
+struct Keyword {
+    std::string_view name;
+    Enum value;
+};
+
+/**
+ * Maps each keyword of a fixed set to its enum value, via a perfect hash of
+ * (length, first char, last char): a lookup hashes three numbers and does one string comparison,
+ * rather than walking an if/else chain of comparisons.
+ * The hash multiplier is searched for by the constructor, which must run at compile time
+ * (declare tables constexpr), so a keyword set without a perfect hash doesn't compile.
+ */
+template <class Enum, size_t N>
+class KeywordTable {
+    static constexpr unsigned SLOT_BITS = 6;
+    static_assert(N <= (1 << SLOT_BITS) / 2, "too many keywords for KeywordTable");
+
+    std::array<Keyword<Enum>, N> keywords_;
+    std::array<uint8_t, 1 << SLOT_BITS> slots_{};   // 1 + index into keywords_, or 0 if empty
+    uint32_t multiplier_ = 0;
+
+    static constexpr uint32_t key(const std::string_view name) {
+        return uint32_t(name.size()) << 16 | uint32_t(uint8_t(name.front())) << 8 | uint8_t(name.back());
+    }
+
+    constexpr size_t slot(const std::string_view name) const {
+        return uint32_t(key(name) * multiplier_) >> (32 - SLOT_BITS);
+    }
+
+    /* Fill slots_ using multiplier; return false on a collision */
+    constexpr bool try_multiplier(const uint32_t multiplier) {
+        multiplier_ = multiplier;
+        for (auto & s : slots_) {
+            s = 0;
+        }
+        for (size_t i = 0; i < N; i++) {
+            uint8_t & s = slots_[slot(keywords_[i].name)];
+            if (s != 0) {
+                return false;
+            }
+            s = i + 1;
+        }
+        return true;
+    }
+
+    public:
+    constexpr KeywordTable(const std::array<Keyword<Enum>, N> & keywords) : keywords_(keywords) {
+        for (const auto & keyword : keywords_) {
+            if (keyword.name.empty()) {
+                throw std::logic_error("empty keyword (or fewer keywords than declared)");
+            }
+        }
+        // odd multipliers, starting from the golden ratio (Fibonacci hashing)
+        for (uint32_t multiplier = 2654435769u; multiplier != 2654435769u + 2 * 4096; multiplier += 2) {
+            if (try_multiplier(multiplier)) {
+                return;
+            }
+        }
+        throw std::logic_error("no perfect hash found for keywords");
+    }
+
+    /* Value of keyword name, or nullopt if name isn't a keyword */
+    constexpr std::optional<Enum> lookup(const std::string_view name) const {
+        if (name.empty()) {
+            return std::nullopt;
+        }
+        const uint8_t s = slots_[slot(name)];
+        if (s == 0 or keywords_[s - 1].name != name) {
+            return std::nullopt;
+        }
+        return keywords_[s - 1].value;
+    }
+
+    static constexpr size_t size() { return N; }
+
+    constexpr std::string_view name(const Enum value) const {
+        for (const auto & keyword : keywords_) {
+            if (keyword.value == value) {
+                return keyword.name;
+            }
+        }
+        throw std::logic_error("no keyword for value");
+    }
+};
+
+/* Measurement of a line, e.g. client_buffer in
+ * client_buffer,channel=abc,server_id=1 cum_rebuf=2.183 1546379215825000000 */
+enum class Measurement : uint8_t { client_buffer, active_streams, backlog, channel_status, client_error,
+    client_sysinfo, decoder_info, server_info, ssim, video_acked, video_sent, video_size };
+
+constexpr KeywordTable<Measurement, 12> measurements{{{
+    { "client_buffer", Measurement::client_buffer },
+    { "active_streams", Measurement::active_streams },
+    { "backlog", Measurement::backlog },
+    { "channel_status", Measurement::channel_status },
+    { "client_error", Measurement::client_error },
+    { "client_sysinfo", Measurement::client_sysinfo },
+    { "decoder_info", Measurement::decoder_info },
+    { "server_info", Measurement::server_info },
+    { "ssim", Measurement::ssim },
+    { "video_acked", Measurement::video_acked },
+    { "video_sent", Measurement::video_sent },
+    { "video_size", Measurement::video_size },
+}}};
+
+/* Value of the channel tag */
+struct Channel {
+    constexpr static uint8_t COUNT = 9;
+
+    enum class ID : uint8_t { cbs, nbc, abc, fox, univision, pbs, cw, ion, mnt };
+
+    constexpr static KeywordTable<ID, COUNT> names{{{
+        { "cbs", ID::cbs },
+        { "nbc", ID::nbc },
+        { "abc", ID::abc },
+        { "fox", ID::fox },
+        { "univision", ID::univision },
+        { "pbs", ID::pbs },
+        { "cw", ID::cw },
+        { "ion", ID::ion },
+        { "mnt", ID::mnt },
+    }}};
+
+    ID id;
+
+    constexpr Channel(const std::string_view sv)
+        : id()
+    {
+        const std::optional<ID> found = names.lookup(sv);
+        if (not found) { throw std::runtime_error( "unknown channel: " + std::string(sv) ); }
+        id = *found;
+    }
+
+    constexpr Channel(const uint8_t id_int) : id(static_cast<ID>(id_int)) {}
+
+    operator std::string_view() const { return names.name(id); }
+    constexpr operator uint8_t() const { return static_cast<uint8_t>(id); }
+
+    bool operator==(const Channel other) { return id == other.id; }
+    bool operator!=(const Channel other) { return not operator==(other); }
+};
+
+/* Value of a client_buffer line's event field */
+struct EventType {
+    enum class Type : uint8_t { init, startup, play, timer, rebuffer };
+
+    constexpr static KeywordTable<Type, 5> names{{{
+        { "init", Type::init },
+        { "startup", Type::startup },
+        { "play", Type::play },
+        { "timer", Type::timer },
+        { "rebuffer", Type::rebuffer },
+    }}};
+
+    Type type;
+
+    operator std::string_view() const { return names.name(type); }
+
+    EventType(const std::string_view sv)
+        : type()
+    {
+        const std::optional<Type> found = names.lookup(sv);
+        if (not found) { throw std::runtime_error( "unknown event type: " + std::string(sv) ); }
+        type = *found;
+    }
+
+    EventType(const Type type) : type(type) {}
+
+    operator uint8_t() const { return static_cast<uint8_t>(type); }
+
+    bool operator==(const EventType other) const { return type == other.type; }
+    bool operator==(const EventType::Type other) const { return type == other; }
+    bool operator!=(const EventType other) const { return not operator==(other); }
+    bool operator!=(const EventType::Type other) const { return not operator==(other); }
+};
+
+/* Field keys of client_buffer (Event), client_sysinfo (Sysinfo), and video_sent (VideoSent) lines.
+ * A key mapping to none is known, but not stored. */
+enum class EventField : uint8_t { first_init_id, init_id, expt_id, user_id, type, buffer, cum_rebuf, none };
+
+constexpr KeywordTable<EventField, 7> event_fields{{{
+    { "first_init_id", EventField::first_init_id },
+    { "init_id", EventField::init_id },
+    { "expt_id", EventField::expt_id },
+    { "user", EventField::user_id },
+    { "event", EventField::type },
+    { "buffer", EventField::buffer },
+    { "cum_rebuf", EventField::cum_rebuf },
+}}};
+
+enum class SysinfoField : uint8_t { browser_id, expt_id, user_id, first_init_id, init_id, os, ip, none };
+
+constexpr KeywordTable<SysinfoField, 9> sysinfo_fields{{{
+    { "browser", SysinfoField::browser_id },
+    { "expt_id", SysinfoField::expt_id },
+    { "user", SysinfoField::user_id },
+    { "first_init_id", SysinfoField::first_init_id },
+    { "init_id", SysinfoField::init_id },
+    { "os", SysinfoField::os },
+    { "ip", SysinfoField::ip },
+    { "screen_width", SysinfoField::none },
+    { "screen_height", SysinfoField::none },
+}}};
+
+enum class VideoSentField : uint8_t { ssim_index, delivery_rate, expt_id, init_id, first_init_id, user_id, size, none };
+
+constexpr KeywordTable<VideoSentField, 15> video_sent_fields{{{
+    { "ssim_index", VideoSentField::ssim_index },
+    { "delivery_rate", VideoSentField::delivery_rate },
+    { "expt_id", VideoSentField::expt_id },
+    { "init_id", VideoSentField::init_id },
+    { "first_init_id", VideoSentField::first_init_id },
+    { "user", VideoSentField::user_id },
+    { "size", VideoSentField::size },
+    { "buffer", VideoSentField::none },
+    { "cum_rebuffer", VideoSentField::none },
+    { "cwnd", VideoSentField::none },
+    { "format", VideoSentField::none },
+    { "in_flight", VideoSentField::none },
+    { "min_rtt", VideoSentField::none },
+    { "rtt", VideoSentField::none },
+    { "video_ts", VideoSentField::none },
+}}};
+
+#endif
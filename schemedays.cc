@@ -16,6 +16,9 @@
 #include <cassert>
 #include <set>
 #include <dateutil.hh>
+#include <split.hh>
+#include <telemetry.hh>
+#include <summarystore.hh>
 
 #include <sys/time.h>
 #include <sys/resource.h>
@@ -24,7 +27,8 @@ using namespace std;
 using namespace std::literals;
 
 /** 
- * From stdin, parses output of analyze, which contains one line per stream summary.
+ * From stdin, parses output of analyze, which contains one line per stream summary
+ * (or reads the stores of analyze --columnar, given as arguments).
  * To output file, writes a list of days each scheme has run, used to determine the dates to analyze.\n"
  */
 
@@ -50,26 +54,6 @@ size_t memcheck() {
     return usage.ru_maxrss;
 }
 
-void split_on_char(const string_view str, const char ch_to_find, vector<string_view> & ret) {
-    ret.clear();
-
-    bool in_double_quoted_string = false;
-    unsigned int field_start = 0;
-    for (unsigned int i = 0; i < str.size(); i++) {
-        const char ch = str[i];
-        if (ch == '"') {
-            in_double_quoted_string = !in_double_quoted_string;
-        } else if (in_double_quoted_string) {
-            continue;
-        } else if (ch == ch_to_find) {
-            ret.emplace_back(str.substr(field_start, i - field_start));
-            field_start = i + 1;
-        }
-    }
-
-    ret.emplace_back(str.substr(field_start));
-}
-
 uint64_t to_uint64(string_view str) {
     uint64_t ret = -1;
     const auto [ptr, ignore] = from_chars(str.data(), str.data() + str.size(), ret);
@@ -90,15 +74,28 @@ class SchemeDays {
     /* File storing scheme_days */
     string scheme_days_filename;
 
+    // input read by parse_stdin
+    size_t n_lines_read = 0;
+    size_t n_bytes_read = 0;
+
     public: 
     // Populate scheme_days map
-    SchemeDays (const string & scheme_days_filename, Action action): 
+    SchemeDays (const string & scheme_days_filename, Action action, const vector<string> & stores = {}): 
                 scheme_days_filename(scheme_days_filename) {  
-        if (action == BUILD_LIST) {
+        if (action == BUILD_LIST and not stores.empty()) {
+            // populate from the stores' footers (analyze --columnar)
+            MetricsPhase phase{"read_stores"};
+            read_stores(stores);
+        } else if (action == BUILD_LIST) {
             // populate from stdin (i.e. analyze output)
+            MetricsPhase phase{"parse_stdin"};
             parse_stdin(); 
+            phase.add_input(n_lines_read, n_bytes_read);
+            Metrics::get().count("lines", n_lines_read);
+            Metrics::get().count("bytes", n_bytes_read);
         } else {
             // populate from input file 
+            MetricsPhase phase{"read_scheme_days"};
             read_scheme_days();
         }
     }
@@ -121,6 +118,8 @@ class SchemeDays {
 
             getline(cin, line_storage);
             line_no++;
+            n_lines_read++;
+            n_bytes_read += line_storage.size() + 1;
 
             const string_view line{line_storage};
 
@@ -149,6 +148,22 @@ class SchemeDays {
         }   
     }
 
+    /* Populate scheme_days map from summary stores: each partition is one day, and its scheme
+     * dictionary lists the schemes of its streams, so no columns need be read */
+    void read_stores(const vector<string> & filenames) {
+        size_t n_partitions = 0;
+        for (const string & filename : filenames) {
+            const summarystore::File store{filename};
+            for (const summarystore::Partition & partition : store.partitions()) {
+                for (const string & scheme : partition.schemes()) {
+                    scheme_days[scheme].emplace(partition.day);
+                }
+                n_partitions++;
+            }
+        }
+        Metrics::get().count("partitions_read", n_partitions);
+    }
+
     /* Given the base timestamp and scheme of a stream, add 
      * corresponding day to the set of days the scheme was run.
      * Does not assume input data is sorted in any way. */ 
@@ -278,15 +293,17 @@ class SchemeDays {
 };
 
 void scheme_days_main(const string & scheme_days_filename, const string & desired_schemes,
-                      const string & intersection_filename, Action action) {
+                      const string & intersection_filename, Action action, const vector<string> & stores) {
     // populates map from input data or file
-    SchemeDays scheme_days {scheme_days_filename, action};
+    SchemeDays scheme_days {scheme_days_filename, action, stores};
     if (action == BUILD_LIST) {
         /* Analyze output => scheme days file */
+        MetricsPhase phase{"write_scheme_days"};
         scheme_days.write_scheme_days(); 
         scheme_days.print_summary();    
     } else {
         /* Desired schemes, scheme days file => intersecting days */
+        MetricsPhase phase{"intersect"};
         scheme_days.intersect(desired_schemes, intersection_filename);    
     }
 }
@@ -294,14 +311,17 @@ void scheme_days_main(const string & scheme_days_filename, const string & desire
 void print_usage(const string & program) {
     cerr << "Usage: " << program << " <scheme_days_filename> <action>\n" 
         << "Action: One of\n" 
-        << "\t --build-list: Read analyze output from stdin, and write to scheme_days_filename "
-        "the list of days each scheme was run \n"
+        << "\t --build-list [store...]: Read analyze output from stdin (or the given stores, output of "
+        "analyze --columnar), and write to scheme_days_filename the list of days each scheme was run \n"
         << "\t --intersect-schemes <schemes> --intersect-outfile <intersection_filename>: For the given schemes "
         "(i.e. primary, vintages, or comma-separated list e.g. mpc/bbr,puffer_ttp_cl/bbr), "
-        "read from scheme_days_filename, and write to intersection_filename the schemes and intersecting days\n";
+        "read from scheme_days_filename, and write to intersection_filename the schemes and intersecting days\n"
+        << "PUFFER_METRICS=<file> in the environment: write per-phase timings, RSS and counts as JSON to file\n";
 }
 
 int main(int argc, char *argv[]) {
+    Metrics & metrics = Metrics::get();
+    metrics.set_program("schemedays");
     try {
         if (argc < 1) {
             abort();
@@ -353,7 +373,7 @@ int main(int argc, char *argv[]) {
             }
         }
 
-        if (optind != argc - 1 or action == NONE) {
+        if (optind > argc - 1 or action == NONE or (action == INTERSECTION and optind != argc - 1)) {
             cerr << "Error: Filename and action are required\n";
             print_usage(argv[0]);
             return EXIT_FAILURE;
@@ -365,12 +385,16 @@ int main(int argc, char *argv[]) {
         }
 
         string scheme_days_filename = argv[optind]; 
-        scheme_days_main(scheme_days_filename, desired_schemes, intersection_filename, action);
+        const vector<string> stores(argv + optind + 1, argv + argc);
+        scheme_days_main(scheme_days_filename, desired_schemes, intersection_filename, action, stores);
 
     } catch (const exception & e) {
         cerr << e.what() << "\n";
+        metrics.set_error(e.what());
+        metrics.write();
         return EXIT_FAILURE;
     }
 
+    metrics.write();
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,85 @@
+/* Temporary files for data moved out of memory (e.g. analyze's tables, over --memory-budget). */
+
+#ifndef SPILL_HH
+#define SPILL_HH
+
+#include <string>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+
+#include <unistd.h>
+#include <stdlib.h>
+
+/**
+ * An anonymous temporary file: created in a directory and unlinked at once, so it goes away
+ * when closed, however the process exits. Written by appending; read back by offset (from any thread).
+ */
+class SpillFile {
+    int fd_;
+    uint64_t size_ = 0;
+
+    [[noreturn]] static void throw_errno(const std::string & what) {
+        throw std::runtime_error(what + ": " + strerror(errno));
+    }
+
+    static int make_temporary(const std::string & dir) {
+        std::string path = dir + "/spill-XXXXXX";
+        const int fd = mkstemp(path.data());
+        if (fd < 0) {
+            throw_errno("can't create spill file in " + dir);
+        }
+        unlink(path.c_str());
+        return fd;
+    }
+
+    public:
+    explicit SpillFile(const std::string & dir) : fd_(make_temporary(dir)) {}
+
+    SpillFile(const SpillFile &) = delete;
+    SpillFile & operator=(const SpillFile &) = delete;
+
+    ~SpillFile() { close(fd_); }
+
+    /* Write len bytes at the end of the file, returning their offset */
+    uint64_t append(const void * const data, const size_t len) {
+        const uint64_t offset = size_;
+        const char * pos = static_cast<const char *>(data);
+        for (size_t left = len; left > 0; ) {
+            const ssize_t written = pwrite(fd_, pos, left, size_);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw_errno("write to spill file");
+            }
+            pos += written;
+            left -= written;
+            size_ += written;
+        }
+        return offset;
+    }
+
+    /* Read len bytes from offset, which append returned (or a later offset of the same write) */
+    void read(const uint64_t offset, void * const data, const size_t len) const {
+        char * pos = static_cast<char *>(data);
+        for (size_t done = 0; done < len; ) {
+            const ssize_t n = pread(fd_, pos + done, len - done, offset + done);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw_errno("read from spill file");
+            }
+            if (n == 0) {
+                throw std::runtime_error("spill file is shorter than expected");
+            }
+            done += n;
+        }
+    }
+
+    uint64_t size() const { return size_; }
+};
+
+#endif
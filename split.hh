@@ -0,0 +1,99 @@
+/* Quote-aware field splitter, used by parser/analyze/confinterval/schemedays. */
+
+#ifndef SPLIT_HH
+#define SPLIT_HH
+
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace split_detail {
+#if defined(__AVX2__)
+    constexpr size_t BLOCK_SIZE = 32;
+
+    /* Bitmasks of the bytes of block equal to ch and to '"' */
+    inline void find_in_block(const char * block, const char ch, uint32_t & chs, uint32_t & quotes) {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block));
+        chs = _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(ch)));
+        quotes = _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('"')));
+    }
+#elif defined(__SSE2__)
+    constexpr size_t BLOCK_SIZE = 16;
+
+    inline void find_in_block(const char * block, const char ch, uint32_t & chs, uint32_t & quotes) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block));
+        chs = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(ch)));
+        quotes = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('"')));
+    }
+#else
+    constexpr size_t BLOCK_SIZE = 0;   // scalar only
+#endif
+
+    /* Bit i is set iff an odd number of bits 0..i are set in x */
+    inline uint32_t prefix_xor(uint32_t x) {
+        x ^= x << 1;
+        x ^= x << 2;
+        x ^= x << 4;
+        x ^= x << 8;
+        x ^= x << 16;
+        return x;
+    }
+}
+
+/**
+ * Split str on ch_to_find, ignoring occurrences inside double-quoted strings
+ * (e.g. splitting user="a b",os="c d" on ',' gives two fields). Quotes are kept in the fields.
+ * ret always gets at least one (possibly empty) field.
+ *
+ * Scans a block of 16 or 32 bytes at a time (SSE2 or AVX2, whichever the build targets),
+ * comparing every byte at once: a byte is inside quotes iff an odd number of quotes precede it,
+ * i.e. the prefix XOR of the block's quote bitmask, carried over from the previous block.
+ * The tail shorter than a block (or the whole string, without SIMD) is scanned bytewise.
+ */
+inline void split_on_char(const std::string_view str, const char ch_to_find, std::vector<std::string_view> & ret) {
+    ret.clear();
+
+    size_t field_start = 0;   // start of next token
+    size_t i = 0;
+    bool in_double_quoted_string = false;
+
+#if defined(__AVX2__) || defined(__SSE2__)
+    using split_detail::BLOCK_SIZE;
+    uint32_t in_quotes_carry = 0;   // all ones if the previous block ended inside a quoted string
+    for (; i + BLOCK_SIZE <= str.size(); i += BLOCK_SIZE) {
+        uint32_t delimiters, quotes;
+        split_detail::find_in_block(str.data() + i, ch_to_find, delimiters, quotes);
+
+        const uint32_t in_quotes = split_detail::prefix_xor(quotes) ^ in_quotes_carry;
+        in_quotes_carry = (in_quotes >> (BLOCK_SIZE - 1)) & 1 ? ~uint32_t(0) : 0;
+        delimiters &= ~quotes & ~in_quotes;
+
+        for (; delimiters; delimiters &= delimiters - 1) {
+            const size_t delimiter = i + __builtin_ctz(delimiters);
+            ret.emplace_back(str.substr(field_start, delimiter - field_start));
+            field_start = delimiter + 1;
+        }
+    }
+    in_double_quoted_string = in_quotes_carry;
+#endif
+
+    for (; i < str.size(); i++) {
+        const char ch = str[i];
+        if (ch == '"') {
+            in_double_quoted_string = !in_double_quoted_string;
+        } else if (in_double_quoted_string) {
+            continue;
+        } else if (ch == ch_to_find) {
+            ret.emplace_back(str.substr(field_start, i - field_start));
+            field_start = i + 1;
+        }
+    }
+
+    ret.emplace_back(str.substr(field_start));
+}
+
+#endif
@@ -0,0 +1,390 @@
+/* Columnar store of analyze's stream summaries (analyze --columnar), read by confinterval and schemedays
+ * without re-parsing text: partitioned by day, with a dictionary of each partition's schemes (and other
+ * strings) and a zone map (min/max) of each of its columns. */
+
+#ifndef SUMMARYSTORE_HH
+#define SUMMARYSTORE_HH
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <type_traits>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <cmath>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <dateutil.hh>
+
+namespace summarystore {
+    /* One stream summary: the fields of a line of analyze's text output, in order */
+    struct Row {
+        uint64_t ts = 0;                // base time, in seconds
+        bool good = false;
+        bool full = false;
+        std::string bad_reason{};
+        std::string scheme{};
+        uint32_t ip = 0;                // network byte order
+        std::string os{};
+        int32_t channel_changes = -1;
+        uint32_t init_id = 0;
+        double extent = 0;
+        double used_pct = 0;
+        double mean_ssim = 0;
+        double mean_delivery_rate = 0;
+        double average_bitrate = 0;
+        double ssim_variation_db = 0;
+        double startup_delay = 0;
+        double total_after_startup = 0;
+        double stall_after_startup = 0;
+    };
+
+    enum class Column : uint8_t {
+        ts, good, full, bad_reason, scheme, ip, os, channel_changes, init_id, extent, used_pct, mean_ssim,
+        mean_delivery_rate, average_bitrate, ssim_variation_db, startup_delay, total_after_startup,
+        stall_after_startup
+    };
+    constexpr size_t COLUMN_COUNT = 18;
+
+    /* Type of a column's values; dict is a uint32_t id into the partition's dictionary for the column */
+    enum class Type : uint8_t { u8 = 0, u32 = 1, i32 = 2, u64 = 3, f64 = 4, dict = 5 };
+
+    constexpr std::array<Type, COLUMN_COUNT> COLUMN_TYPES = {
+        Type::u64, Type::u8, Type::u8, Type::dict, Type::dict, Type::u32, Type::dict, Type::i32, Type::u32,
+        Type::f64, Type::f64, Type::f64, Type::f64, Type::f64, Type::f64, Type::f64, Type::f64, Type::f64
+    };
+
+    constexpr size_t type_size(const Type type) {
+        switch (type) {
+            case Type::u8: return 1;
+            case Type::u32: case Type::i32: case Type::dict: return 4;
+            case Type::u64: case Type::f64: return 8;
+        }
+        return 0;
+    }
+
+    /* C++ type of a column's values, for File::read_column */
+    template <class T> constexpr bool holds(const Type type) {
+        switch (type) {
+            case Type::u8: return std::is_same_v<T, uint8_t>;
+            case Type::u32: case Type::dict: return std::is_same_v<T, uint32_t>;
+            case Type::i32: return std::is_same_v<T, int32_t>;
+            case Type::u64: return std::is_same_v<T, uint64_t>;
+            case Type::f64: return std::is_same_v<T, double>;
+        }
+        return false;
+    }
+
+    constexpr char MAGIC[8] = {'P', 'U', 'F', 'S', 'U', 'M', 'S', '1'};
+    constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    /* Where a column of a partition is, and the range of its values (for dict columns, of the ids).
+     * A NaN widens the range to everything, so the zone map never excludes a row it holds. */
+    struct ColumnChunk {
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        double min = std::numeric_limits<double>::infinity();
+        double max = -std::numeric_limits<double>::infinity();
+        std::vector<std::string> dictionary{};      // dict columns: the strings, by id
+
+        void add_to_range(const double value) {
+            if (std::isnan(value)) {
+                min = -std::numeric_limits<double>::infinity();
+                max = std::numeric_limits<double>::infinity();
+                return;
+            }
+            min = std::min(min, value);
+            max = std::max(max, value);
+        }
+
+        /* Whether some value may lie in [lo, hi] */
+        bool may_overlap(const double lo, const double hi) const { return min <= hi and max >= lo; }
+    };
+
+    /* The rows of one day (Day_sec of their ts), column by column */
+    struct Partition {
+        Day_sec day = 0;
+        uint64_t n_rows = 0;
+        std::array<ColumnChunk, COLUMN_COUNT> columns{};
+
+        const ColumnChunk & column(const Column c) const { return columns[uint8_t(c)]; }
+
+        /* The schemes of its rows (the scheme column's dictionary) */
+        const std::vector<std::string> & schemes() const { return column(Column::scheme).dictionary; }
+    };
+
+    /**
+     * Builds a store in memory, from rows in any order (each goes to the partition of its day,
+     * keeping their order within it), and writes it out in one pass, so out may be a pipe.
+     * Layout: MAGIC; each partition's columns, in order, each padded to 8 bytes; the footer;
+     * the footer's offset (uint64_t); MAGIC. The footer is BYTE_ORDER_MARK, the number of partitions,
+     * and for each its day and number of rows, then for each column its type, offset, size,
+     * min, max, and dictionary (number of strings; each one's length as uint32_t, then its bytes).
+     * Numbers are in the writer's byte order, which the reader checks against BYTE_ORDER_MARK.
+     */
+    class Writer {
+        struct PartitionBuilder {
+            Partition partition{};
+            std::array<std::string, COLUMN_COUNT> data{};
+            std::array<std::unordered_map<std::string, uint32_t>, COLUMN_COUNT> ids{};
+
+            template <class T>
+            void append(const Column c, const T value) {
+                std::string & column_data = data[uint8_t(c)];
+                const size_t size = column_data.size();
+                column_data.resize(size + sizeof(T));
+                memcpy(column_data.data() + size, &value, sizeof(T));
+                partition.columns[uint8_t(c)].add_to_range(double(value));
+            }
+
+            void append_string(const Column c, const std::string & value) {
+                const auto [it, inserted] = ids[uint8_t(c)].try_emplace(value, ids[uint8_t(c)].size());
+                if (inserted) {
+                    partition.columns[uint8_t(c)].dictionary.push_back(value);
+                }
+                append<uint32_t>(c, it->second);
+            }
+        };
+
+        std::map<Day_sec, PartitionBuilder> partitions_{};
+        uint64_t n_rows_ = 0;
+
+        template <class T>
+        static void put(std::string & out, const T value) {
+            out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+        }
+
+        public:
+        void add(const Row & row) {
+            PartitionBuilder & builder = partitions_[ts2Day_sec(row.ts)];
+            builder.partition.n_rows++;
+            n_rows_++;
+
+            builder.append<uint64_t>(Column::ts, row.ts);
+            builder.append<uint8_t>(Column::good, row.good);
+            builder.append<uint8_t>(Column::full, row.full);
+            builder.append_string(Column::bad_reason, row.bad_reason);
+            builder.append_string(Column::scheme, row.scheme);
+            builder.append<uint32_t>(Column::ip, row.ip);
+            builder.append_string(Column::os, row.os);
+            builder.append<int32_t>(Column::channel_changes, row.channel_changes);
+            builder.append<uint32_t>(Column::init_id, row.init_id);
+            builder.append<double>(Column::extent, row.extent);
+            builder.append<double>(Column::used_pct, row.used_pct);
+            builder.append<double>(Column::mean_ssim, row.mean_ssim);
+            builder.append<double>(Column::mean_delivery_rate, row.mean_delivery_rate);
+            builder.append<double>(Column::average_bitrate, row.average_bitrate);
+            builder.append<double>(Column::ssim_variation_db, row.ssim_variation_db);
+            builder.append<double>(Column::startup_delay, row.startup_delay);
+            builder.append<double>(Column::total_after_startup, row.total_after_startup);
+            builder.append<double>(Column::stall_after_startup, row.stall_after_startup);
+        }
+
+        uint64_t rows() const { return n_rows_; }
+        size_t partitions() const { return partitions_.size(); }
+
+        /* Write the store to out, returning the bytes written */
+        uint64_t write(std::ostream & out) {
+            uint64_t offset = sizeof(MAGIC);
+            out.write(MAGIC, sizeof(MAGIC));
+            for (auto & [day, builder] : partitions_) {
+                builder.partition.day = day;
+                for (size_t c = 0; c < COLUMN_COUNT; c++) {
+                    std::string & column_data = builder.data[c];
+                    builder.partition.columns[c].offset = offset;
+                    builder.partition.columns[c].size = column_data.size();
+                    column_data.resize((column_data.size() + 7) / 8 * 8);
+                    out.write(column_data.data(), column_data.size());
+                    offset += column_data.size();
+                    std::string().swap(column_data);
+                }
+            }
+
+            std::string footer;
+            put<uint32_t>(footer, BYTE_ORDER_MARK);
+            put<uint32_t>(footer, partitions_.size());
+            for (const auto & [day, builder] : partitions_) {
+                const Partition & partition = builder.partition;
+                put<uint64_t>(footer, partition.day);
+                put<uint64_t>(footer, partition.n_rows);
+                for (size_t c = 0; c < COLUMN_COUNT; c++) {
+                    const ColumnChunk & chunk = partition.columns[c];
+                    put<uint8_t>(footer, uint8_t(COLUMN_TYPES[c]));
+                    put<uint64_t>(footer, chunk.offset);
+                    put<uint64_t>(footer, chunk.size);
+                    put<double>(footer, chunk.min);
+                    put<double>(footer, chunk.max);
+                    put<uint32_t>(footer, chunk.dictionary.size());
+                    for (const std::string & str : chunk.dictionary) {
+                        put<uint32_t>(footer, str.size());
+                        footer += str;
+                    }
+                }
+            }
+            put<uint64_t>(footer, offset);
+            footer.append(MAGIC, sizeof(MAGIC));
+            out.write(footer.data(), footer.size());
+
+            partitions_.clear();
+            n_rows_ = 0;
+            return offset + footer.size();
+        }
+    };
+
+    /**
+     * A store written by Writer, mmapped. Its footer (partitions, dictionaries and zone maps) is read
+     * when opened; a column is only read (paged in) when asked for, so callers read just the columns
+     * they use, of just the partitions whose zone maps might match.
+     */
+    class File {
+        std::string filename_;
+        int fd_;
+        const uint8_t * map_ = nullptr;
+        size_t size_ = 0;
+        std::vector<Partition> partitions_{};
+
+        void release() {
+            if (map_) {
+                munmap(const_cast<uint8_t *>(map_), size_);
+                map_ = nullptr;
+            }
+            if (fd_ >= 0) {
+                close(fd_);
+                fd_ = -1;
+            }
+        }
+
+        [[noreturn]] void fail(const std::string & what) {
+            release();
+            throw std::runtime_error(what + ": " + filename_);
+        }
+
+        [[noreturn]] void fail_errno(const std::string & what) {
+            fail(what + " (" + strerror(errno) + ")");
+        }
+
+        /* Cursor over the footer; reads past its end fail */
+        class Footer {
+            File & file_;
+            const uint8_t * pos_;
+            const uint8_t * end_;
+
+            public:
+            Footer(File & file, const uint8_t * pos, const uint8_t * end) : file_(file), pos_(pos), end_(end) {}
+
+            const uint8_t * take(const size_t n) {
+                if (n > size_t(end_ - pos_)) {
+                    file_.fail("corrupt summary store footer");
+                }
+                const uint8_t * ret = pos_;
+                pos_ += n;
+                return ret;
+            }
+
+            template <class T>
+            T get() {
+                T ret;
+                memcpy(&ret, take(sizeof(T)), sizeof(T));
+                return ret;
+            }
+        };
+
+        void read_footer() {
+            const uint8_t * trailer = map_ + size_ - sizeof(uint64_t) - sizeof(MAGIC);
+            uint64_t footer_offset;
+            memcpy(&footer_offset, trailer, sizeof(footer_offset));
+            if (memcmp(map_, MAGIC, sizeof(MAGIC)) or memcmp(trailer + sizeof(uint64_t), MAGIC, sizeof(MAGIC))) {
+                fail("not a summary store (analyze --columnar output)");
+            }
+            if (footer_offset < sizeof(MAGIC) or footer_offset > size_t(trailer - map_)) {
+                fail("corrupt summary store footer offset");
+            }
+
+            Footer footer{*this, map_ + footer_offset, trailer};
+            if (footer.get<uint32_t>() != BYTE_ORDER_MARK) {
+                fail("summary store written with another byte order");
+            }
+            partitions_.resize(footer.get<uint32_t>());
+            for (Partition & partition : partitions_) {
+                partition.day = footer.get<uint64_t>();
+                partition.n_rows = footer.get<uint64_t>();
+                for (size_t c = 0; c < COLUMN_COUNT; c++) {
+                    ColumnChunk & chunk = partition.columns[c];
+                    if (footer.get<uint8_t>() != uint8_t(COLUMN_TYPES[c])) {
+                        fail("summary store column " + std::to_string(c) + " has an unexpected type");
+                    }
+                    chunk.offset = footer.get<uint64_t>();
+                    chunk.size = footer.get<uint64_t>();
+                    chunk.min = footer.get<double>();
+                    chunk.max = footer.get<double>();
+                    if (chunk.offset < sizeof(MAGIC) or chunk.offset + chunk.size > footer_offset
+                        or chunk.size != partition.n_rows * type_size(COLUMN_TYPES[c])) {
+                        fail("corrupt summary store column " + std::to_string(c));
+                    }
+                    chunk.dictionary.resize(footer.get<uint32_t>());
+                    for (std::string & str : chunk.dictionary) {
+                        const uint32_t length = footer.get<uint32_t>();
+                        str.assign(reinterpret_cast<const char *>(footer.take(length)), length);
+                    }
+                }
+            }
+        }
+
+        public:
+        explicit File(const std::string & filename) : filename_(filename), fd_(open(filename.c_str(), O_RDONLY)) {
+            if (fd_ < 0) {
+                fail_errno("open");
+            }
+            struct stat st{};
+            if (fstat(fd_, &st) < 0) {
+                fail_errno("fstat");
+            }
+            size_ = st.st_size;
+            if (size_ < 2 * sizeof(MAGIC) + sizeof(uint64_t)) {
+                fail("not a summary store (analyze --columnar output)");
+            }
+            void * map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+            if (map == MAP_FAILED) {
+                fail_errno("mmap");
+            }
+            map_ = static_cast<const uint8_t *>(map);
+            read_footer();
+        }
+
+        ~File() { release(); }
+
+        File(const File &) = delete;
+        File & operator=(const File &) = delete;
+
+        const std::string & filename() const { return filename_; }
+
+        const std::vector<Partition> & partitions() const { return partitions_; }
+
+        /* Read column c of partition (one of this file's) into values; T must hold its type
+         * (uint32_t ids for dict columns). Returns the bytes read. */
+        template <class T>
+        size_t read_column(const Partition & partition, const Column c, std::vector<T> & values) const {
+            if (not holds<T>(COLUMN_TYPES[uint8_t(c)])) {
+                throw std::logic_error("summary store column " + std::to_string(uint8_t(c)) + " read as the wrong type");
+            }
+            const ColumnChunk & chunk = partition.column(c);
+            values.resize(partition.n_rows);
+            memcpy(values.data(), map_ + chunk.offset, chunk.size);
+            return chunk.size;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,193 @@
+/* Performance metrics for parser/analyze/confinterval/schemedays: per-phase wall and CPU time,
+ * peak RSS, throughput and counters, written as one JSON record when PUFFER_METRICS names a file
+ * (e.g. PUFFER_METRICS=/dev/fd/3 for a file descriptor). */
+
+#ifndef TELEMETRY_HH
+#define TELEMETRY_HH
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/**
+ * Process-wide metrics record. A run is a unit of work with its own phases and counters
+ * (e.g. one day of analyze --batch); there is always a current run, unlabeled until begin_run.
+ * Phases are timed with MetricsPhase. Nothing is written unless enabled().
+ */
+class Metrics {
+    struct PhaseRecord {
+        std::string name;
+        double wall_s, cpu_s;
+        long peak_rss_kib;
+        uint64_t lines, bytes;
+        bool failed;
+    };
+
+    struct Run {
+        std::string label{};
+        std::vector<PhaseRecord> phases{};
+        std::map<std::string, uint64_t> counters{};
+    };
+
+    std::string filename_;
+    std::string program_{};
+    std::string error_{};
+    std::vector<Run> runs_{1};
+    std::chrono::steady_clock::time_point start_wall_ = std::chrono::steady_clock::now();
+    double start_cpu_ = cpu_seconds();
+
+    Metrics() : filename_(std::getenv("PUFFER_METRICS") ? std::getenv("PUFFER_METRICS") : "") {}
+
+    static std::string json_string(const std::string_view str) {
+        std::ostringstream out;
+        out << '"';
+        for (const char c : str) {
+            switch (c) {
+                case '"': out << "\\\""; break;
+                case '\\': out << "\\\\"; break;
+                case '\n': out << "\\n"; break;
+                case '\t': out << "\\t"; break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec;
+                    } else {
+                        out << c;
+                    }
+            }
+        }
+        out << '"';
+        return out.str();
+    }
+
+    public:
+    Metrics(const Metrics &) = delete;
+    Metrics & operator=(const Metrics &) = delete;
+
+    static Metrics & get() {
+        static Metrics metrics;
+        return metrics;
+    }
+
+    /* User + system time of all threads so far */
+    static double cpu_seconds() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+            + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    }
+
+    static long peak_rss_kib() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    bool enabled() const { return not filename_.empty(); }
+
+    void set_program(const std::string & program) { program_ = program; }
+
+    /* Start a new run (its phases and counters are reported separately), e.g. for another day */
+    void begin_run(const std::string & label) {
+        if (runs_.back().label.empty() and runs_.back().phases.empty() and runs_.back().counters.empty()) {
+            runs_.back().label = label;
+        } else {
+            runs_.push_back({label, {}, {}});
+        }
+    }
+
+    /* Add n to a counter of the current run */
+    void count(const std::string & name, const uint64_t n) { runs_.back().counters[name] += n; }
+
+    void add_phase(PhaseRecord record) { runs_.back().phases.push_back(std::move(record)); }
+
+    void set_error(const std::string & error) { error_ = error; }
+
+    /* Write the record to PUFFER_METRICS, if set (replacing the file) */
+    void write() const {
+        if (not enabled()) {
+            return;
+        }
+        std::ofstream out{filename_};
+        if (not out.is_open()) {
+            perror(("can't open PUFFER_METRICS file " + filename_).c_str());
+            return;
+        }
+
+        const double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_wall_).count();
+        out << std::fixed << std::setprecision(6);
+        out << "{\"program\":" << json_string(program_)
+            << ",\"wall_s\":" << wall_s << ",\"cpu_s\":" << cpu_seconds() - start_cpu_
+            << ",\"peak_rss_mib\":" << peak_rss_kib() / 1024
+            << ",\"error\":" << (error_.empty() ? "null" : json_string(error_))
+            << ",\"runs\":[";
+        for (size_t r = 0; r < runs_.size(); r++) {
+            const Run & run = runs_[r];
+            out << (r ? "," : "") << "{\"label\":" << json_string(run.label) << ",\"phases\":[";
+            for (size_t p = 0; p < run.phases.size(); p++) {
+                const PhaseRecord & phase = run.phases[p];
+                out << (p ? "," : "") << "{\"name\":" << json_string(phase.name)
+                    << ",\"wall_s\":" << phase.wall_s << ",\"cpu_s\":" << phase.cpu_s
+                    << ",\"peak_rss_mib\":" << phase.peak_rss_kib / 1024;
+                if (phase.lines > 0) {
+                    out << ",\"lines\":" << phase.lines << ",\"lines_per_s\":" << phase.lines / phase.wall_s;
+                }
+                if (phase.bytes > 0) {
+                    out << ",\"bytes\":" << phase.bytes << ",\"bytes_per_s\":" << phase.bytes / phase.wall_s;
+                }
+                out << ",\"failed\":" << (phase.failed ? "true" : "false") << "}";
+            }
+            out << "],\"counters\":{";
+            bool first = true;
+            for (const auto & [name, value] : run.counters) {
+                out << (first ? "" : ",") << json_string(name) << ":" << value;
+                first = false;
+            }
+            out << "}}";
+        }
+        out << "]}\n";
+    }
+};
+
+/**
+ * Times one phase of the current run, from construction to destruction.
+ * A phase ended by an exception is marked failed. Throughput is reported if set with add_input.
+ */
+class MetricsPhase {
+    std::string name_;
+    std::chrono::steady_clock::time_point start_wall_ = std::chrono::steady_clock::now();
+    double start_cpu_ = Metrics::cpu_seconds();
+    int uncaught_ = std::uncaught_exceptions();
+    uint64_t lines_ = 0, bytes_ = 0;
+
+    public:
+    explicit MetricsPhase(const std::string & name) : name_(name) {}
+
+    MetricsPhase(const MetricsPhase &) = delete;
+    MetricsPhase & operator=(const MetricsPhase &) = delete;
+
+    /* Count input processed by this phase, for lines_per_s and bytes_per_s */
+    void add_input(const uint64_t lines, const uint64_t bytes) {
+        lines_ += lines;
+        bytes_ += bytes;
+    }
+
+    ~MetricsPhase() {
+        const double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_wall_).count();
+        Metrics::get().add_phase({ name_, wall_s, Metrics::cpu_seconds() - start_cpu_, Metrics::peak_rss_kib(),
+                                   lines_, bytes_, std::uncaught_exceptions() > uncaught_ });
+    }
+};
+
+#endif
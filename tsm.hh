@@ -0,0 +1,550 @@
+/* Reader for the TSM files of InfluxDB 1.x shards (e.g. the .tsm files under puffer/retention32d/ in a backup),
+ * decoding their blocks directly rather than via influx_inspect export's line protocol. */
+
+#ifndef TSM_HH
+#define TSM_HH
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace tsm {
+    /* Type of a key's values; the first byte of each of its blocks */
+    enum class BlockType : uint8_t { float64 = 0, integer = 1, boolean = 2, string = 3, unsigned64 = 4 };
+
+    /* Index entry locating one block of a key's values */
+    struct BlockEntry {
+        uint64_t min_time;
+        uint64_t max_time;
+        uint64_t offset;    // of the block's CRC, which precedes it
+        uint32_t size;      // including the CRC
+    };
+
+    /* One value of a block, in the member for the block's type */
+    struct Value {
+        BlockType type;
+        double float64;
+        int64_t integer;    // integer or (bit-cast) unsigned
+        std::string_view string;
+    };
+
+    /* A decoded block: timestamps, and values in the vector for its type */
+    struct Block {
+        BlockType type = BlockType::float64;
+        std::vector<uint64_t> timestamps{};
+        std::vector<double> floats{};
+        std::vector<int64_t> integers{};
+        std::vector<std::string_view> strings{};    // views into string_data
+        std::string string_data{};
+
+        size_t size() const { return timestamps.size(); }
+
+        Value value(const size_t i) const {
+            switch (type) {
+                case BlockType::float64: return { type, floats[i], 0, {} };
+                case BlockType::integer:
+                case BlockType::unsigned64: return { type, 0, integers[i], {} };
+                case BlockType::string: return { type, 0, 0, strings[i] };
+                case BlockType::boolean: break;
+            }
+            throw std::logic_error("no values in block");
+        }
+    };
+
+    namespace detail {
+        [[noreturn]] inline void corrupt(const std::string & what) {
+            throw std::runtime_error("corrupt TSM data: " + what);
+        }
+
+        /* Cursor over a byte range; reads past its end throw */
+        class Bytes {
+            const uint8_t * pos_;
+            const uint8_t * end_;
+
+            public:
+            Bytes(const uint8_t * data, const size_t size) : pos_(data), end_(data + size) {}
+
+            size_t remaining() const { return end_ - pos_; }
+
+            const uint8_t * take(const size_t n) {
+                if (n > remaining()) {
+                    corrupt("truncated");
+                }
+                const uint8_t * ret = pos_;
+                pos_ += n;
+                return ret;
+            }
+
+            uint8_t u8() { return *take(1); }
+
+            /* Big-endian unsigned integer of n bytes */
+            uint64_t be(const size_t n) {
+                const uint8_t * p = take(n);
+                uint64_t ret = 0;
+                for (size_t i = 0; i < n; i++) {
+                    ret = ret << 8 | p[i];
+                }
+                return ret;
+            }
+
+            /* Little-endian unsigned integer of n bytes */
+            uint64_t le(const size_t n) {
+                const uint8_t * p = take(n);
+                uint64_t ret = 0;
+                for (size_t i = n; i > 0; i--) {
+                    ret = ret << 8 | p[i - 1];
+                }
+                return ret;
+            }
+
+            /* Variable-length integer, 7 bits per byte, least significant first (Go's binary.Uvarint) */
+            uint64_t uvarint() {
+                uint64_t ret = 0;
+                for (unsigned shift = 0; shift < 64; shift += 7) {
+                    const uint8_t byte = u8();
+                    ret |= uint64_t(byte & 0x7F) << shift;
+                    if (not (byte & 0x80)) {
+                        return ret;
+                    }
+                }
+                corrupt("varint overflow");
+            }
+        };
+
+        /* Reads a bitstream most significant bit first (as the float encoder writes it) */
+        class BitReader {
+            Bytes & bytes_;
+            uint64_t buffer_ = 0;   // unread bits, aligned to the top
+            unsigned n_buffered_ = 0;
+
+            public:
+            explicit BitReader(Bytes & bytes) : bytes_(bytes) {}
+
+            /* Next n bits (1 <= n <= 64) */
+            uint64_t read(const unsigned n) {
+                uint64_t ret = 0;
+                unsigned needed = n;
+                while (needed > 0) {
+                    if (n_buffered_ == 0) {
+                        // refill a byte at a time near the end, otherwise 8 at a time
+                        const size_t n_bytes = std::min<size_t>(bytes_.remaining(), 8);
+                        if (n_bytes == 0) {
+                            corrupt("truncated bitstream");
+                        }
+                        buffer_ = bytes_.be(n_bytes) << (64 - 8 * n_bytes);
+                        n_buffered_ = 8 * n_bytes;
+                    }
+                    const unsigned take = std::min(needed, n_buffered_);
+                    // shifting a uint64_t by 64 is undefined, so take == 64 is handled apart
+                    ret = take == 64 ? buffer_ : (ret << take) | (buffer_ >> (64 - take));
+                    buffer_ = take == 64 ? 0 : buffer_ << take;
+                    n_buffered_ -= take;
+                    needed -= take;
+                }
+                return ret;
+            }
+        };
+
+        inline int64_t zigzag_decode(const uint64_t v) {
+            return int64_t(v >> 1) ^ -int64_t(v & 1);
+        }
+
+        /* Pass each value packed in a simple8b word to f: the top 4 bits select how many values
+         * of how many bits each fill the other 60, first value in the lowest bits
+         * (selectors 0 and 1 are runs of 240 and 120 ones) */
+        template <class F>
+        void simple8b_unpack(const uint64_t word, F && f) {
+            static constexpr uint8_t COUNTS[16] = { 240, 120, 60, 30, 20, 15, 12, 10, 8, 7, 6, 5, 4, 3, 2, 1 };
+            static constexpr uint8_t BITS[16] = { 0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 10, 12, 15, 20, 30, 60 };
+            const unsigned selector = word >> 60;
+            const unsigned bits = BITS[selector];
+            if (bits == 0) {
+                for (unsigned i = 0; i < COUNTS[selector]; i++) {
+                    f(1);
+                }
+                return;
+            }
+            const uint64_t mask = (uint64_t(1) << bits) - 1;
+            for (unsigned i = 0; i < COUNTS[selector]; i++) {
+                f((word >> (i * bits)) & mask);
+            }
+        }
+
+        // a run-length-encoded block repeating more than this is taken as corrupt
+        constexpr uint64_t MAX_RUN = 1 << 24;
+
+        /* Timestamps: first, then deltas (divided by a power of ten, given in the header's low bits),
+         * either simple8b-packed, run-length encoded, or as raw 8-byte integers */
+        inline void decode_timestamps(Bytes bytes, std::vector<uint64_t> & out) {
+            out.clear();
+            if (bytes.remaining() == 0) {
+                return;
+            }
+            const uint8_t header = bytes.u8();
+            if ((header & 0xF) > 12) {
+                corrupt("timestamp divisor");
+            }
+            uint64_t scale = 1;
+            for (unsigned i = 0; i < (header & 0xF); i++) {
+                scale *= 10;
+            }
+
+            switch (header >> 4) {
+                case 0:     // uncompressed (unscaled) deltas
+                    while (bytes.remaining() > 0) {
+                        const uint64_t delta = bytes.be(8);
+                        out.push_back(out.empty() ? delta : out.back() + delta);
+                    }
+                    return;
+                case 1: {   // packed
+                    uint64_t ts = bytes.be(8);
+                    out.push_back(ts);
+                    while (bytes.remaining() > 0) {
+                        simple8b_unpack(bytes.be(8), [&](const uint64_t delta) {
+                            ts += delta * scale;
+                            out.push_back(ts);
+                        });
+                    }
+                    return;
+                }
+                case 2: {   // run-length: n timestamps, a constant delta apart
+                    const uint64_t first = bytes.be(8);
+                    const uint64_t delta = bytes.uvarint() * scale;
+                    const uint64_t n = bytes.uvarint();
+                    if (n > MAX_RUN) {
+                        corrupt("timestamp run length");
+                    }
+                    for (uint64_t i = 0; i < n; i++) {
+                        out.push_back(first + i * delta);
+                    }
+                    return;
+                }
+            }
+            corrupt("timestamp encoding");
+        }
+
+        /* Floats: Gorilla XOR compression (each value as its XOR with the previous one:
+         * '0' if equal, else '1' and the meaningful bits, reusing the previous leading/trailing
+         * zero counts after a '0' or giving new ones after a '1'), ended by a NaN */
+        inline void decode_floats(Bytes bytes, std::vector<double> & out) {
+            out.clear();
+            if (bytes.remaining() == 0) {
+                return;
+            }
+            if (bytes.u8() >> 4 != 1) {
+                corrupt("float encoding");
+            }
+            constexpr uint64_t END = 0x7FF8000000000001;    // Go's math.NaN()
+
+            BitReader bits{bytes};
+            uint64_t value = bits.read(64);
+            unsigned leading = 0, trailing = 0;
+            while (value != END) {
+                double d;
+                memcpy(&d, &value, sizeof(d));
+                out.push_back(d);
+
+                if (not bits.read(1)) {
+                    continue;   // same value
+                }
+                if (bits.read(1)) {
+                    leading = bits.read(5);
+                    unsigned meaningful = bits.read(6);
+                    if (meaningful == 0) {
+                        meaningful = 64;    // doesn't fit in 6 bits, and 0 can't occur
+                    }
+                    if (leading + meaningful > 64) {
+                        corrupt("float bit counts");
+                    }
+                    trailing = 64 - leading - meaningful;
+                }
+                value ^= bits.read(64 - leading - trailing) << trailing;
+            }
+        }
+
+        /* Integers: zigzag-encoded deltas, either simple8b-packed after a raw first value,
+         * run-length encoded, or all as raw 8-byte integers.
+         * Sums wrap around (as in the Go encoder), so they're done unsigned. */
+        inline void decode_integers(Bytes bytes, std::vector<int64_t> & out) {
+            out.clear();
+            if (bytes.remaining() == 0) {
+                return;
+            }
+            uint64_t value = 0;
+            switch (bytes.u8() >> 4) {
+                case 0:     // uncompressed
+                    while (bytes.remaining() > 0) {
+                        value += zigzag_decode(bytes.be(8));
+                        out.push_back(value);
+                    }
+                    return;
+                case 1:     // packed
+                    value = zigzag_decode(bytes.be(8));
+                    out.push_back(value);
+                    while (bytes.remaining() > 0) {
+                        simple8b_unpack(bytes.be(8), [&](const uint64_t delta) {
+                            value += zigzag_decode(delta);
+                            out.push_back(value);
+                        });
+                    }
+                    return;
+                case 2: {   // run-length: first, then n more, a constant delta apart
+                    value = zigzag_decode(bytes.be(8));
+                    const uint64_t delta = zigzag_decode(bytes.uvarint());
+                    const uint64_t n = bytes.uvarint();
+                    if (n > MAX_RUN) {
+                        corrupt("integer run length");
+                    }
+                    for (uint64_t i = 0; i <= n; i++, value += delta) {
+                        out.push_back(value);
+                    }
+                    return;
+                }
+            }
+            corrupt("integer encoding");
+        }
+
+        /* Snappy (raw block format): uncompressed length, then literals and back-references */
+        inline void snappy_decompress(Bytes bytes, std::string & out) {
+            const uint64_t length = bytes.uvarint();
+            if (length > (uint64_t(1) << 32)) {
+                corrupt("snappy length");
+            }
+            out.resize(length);
+            size_t pos = 0;
+            while (bytes.remaining() > 0) {
+                const uint8_t tag = bytes.u8();
+                size_t n, offset;
+                switch (tag & 3) {
+                    case 0:     // literal, length - 1 in the tag or in the 1-4 bytes after it
+                        n = tag >> 2;
+                        if (n >= 60) {
+                            n = bytes.le(n - 59);
+                        }
+                        n++;
+                        if (n > length - pos) {
+                            corrupt("snappy literal");
+                        }
+                        memcpy(&out[pos], bytes.take(n), n);
+                        pos += n;
+                        continue;
+                    case 1:     // copy of 4-11 bytes, 11-bit offset
+                        n = 4 + ((tag >> 2) & 7);
+                        offset = size_t(tag >> 5) << 8 | bytes.u8();
+                        break;
+                    case 2:     // copy of 1-64 bytes, 16-bit offset
+                        n = 1 + (tag >> 2);
+                        offset = bytes.le(2);
+                        break;
+                    default:    // copy of 1-64 bytes, 32-bit offset
+                        n = 1 + (tag >> 2);
+                        offset = bytes.le(4);
+                        break;
+                }
+                if (offset == 0 or offset > pos or n > length - pos) {
+                    corrupt("snappy copy");
+                }
+                // byte by byte, since the source may overlap the destination
+                for (size_t i = 0; i < n; i++, pos++) {
+                    out[pos] = out[pos - offset];
+                }
+            }
+            if (pos != length) {
+                corrupt("snappy length mismatch");
+            }
+        }
+
+        /* Strings: snappy-compressed concatenation of (uvarint length, bytes) */
+        inline void decode_strings(Bytes bytes, std::string & data, std::vector<std::string_view> & out) {
+            out.clear();
+            data.clear();
+            if (bytes.remaining() == 0) {
+                return;
+            }
+            if (bytes.u8() >> 4 != 1) {
+                corrupt("string encoding");
+            }
+            snappy_decompress(bytes, data);
+            Bytes strings{reinterpret_cast<const uint8_t *>(data.data()), data.size()};
+            while (strings.remaining() > 0) {
+                const uint64_t n = strings.uvarint();
+                if (n > strings.remaining()) {
+                    corrupt("string length");
+                }
+                out.emplace_back(reinterpret_cast<const char *>(strings.take(n)), n);
+            }
+        }
+    }
+
+    /**
+     * A TSM file, mmapped: header (magic number, version), blocks, index, and the index's offset.
+     * The index lists each key (series key, "#!~#", field key) in sorted order, with its block type
+     * and an entry per block; a block is a CRC, its type, the uvarint length of its timestamps,
+     * its timestamps, and its values. Integers are big-endian.
+     */
+    class File {
+        static constexpr uint32_t MAGIC = 0x16D116D1;
+        static constexpr size_t HEADER_SIZE = 5;
+        static constexpr size_t BLOCK_ENTRY_SIZE = 28;
+
+        std::string filename_;
+        int fd_;
+        const uint8_t * map_ = nullptr;
+        size_t size_ = 0;
+        uint64_t index_offset_ = 0;
+
+        void release() {
+            if (map_) {
+                munmap(const_cast<uint8_t *>(map_), size_);
+                map_ = nullptr;
+            }
+            if (fd_ >= 0) {
+                close(fd_);
+                fd_ = -1;
+            }
+        }
+
+        /* Release what the constructor acquired so far, then throw */
+        [[noreturn]] void fail(const std::string & what) {
+            release();
+            throw std::runtime_error(what + ": " + filename_);
+        }
+
+        [[noreturn]] void fail_errno(const std::string & what) {
+            fail(what + " (" + strerror(errno) + ")");
+        }
+
+        /* Bytes of the block at entry, past its type, with the timestamps split off
+         * (the block's CRC isn't checked, as in influx_inspect export) */
+        BlockType split_block(const BlockEntry & entry, detail::Bytes & timestamps, detail::Bytes & values) const {
+            detail::Bytes bytes{map_ + entry.offset + 4, entry.size - 4u};
+            const BlockType type = BlockType(bytes.u8());
+            const uint64_t timestamps_size = bytes.uvarint();
+            if (timestamps_size > bytes.remaining()) {
+                detail::corrupt("timestamps size in " + filename_);
+            }
+            timestamps = {bytes.take(timestamps_size), timestamps_size};
+            const size_t values_size = bytes.remaining();
+            values = {bytes.take(values_size), values_size};
+            return type;
+        }
+
+        public:
+        explicit File(const std::string & filename) : filename_(filename), fd_(open(filename.c_str(), O_RDONLY)) {
+            if (fd_ < 0) {
+                fail_errno("open");
+            }
+            struct stat st{};
+            if (fstat(fd_, &st) < 0) {
+                fail_errno("fstat");
+            }
+            size_ = st.st_size;
+            if (size_ < HEADER_SIZE + 8) {
+                fail("not a TSM file");
+            }
+            void * map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+            if (map == MAP_FAILED) {
+                fail_errno("mmap");
+            }
+            map_ = static_cast<const uint8_t *>(map);
+
+            detail::Bytes header{map_, HEADER_SIZE};
+            detail::Bytes footer{map_ + size_ - 8, 8};
+            if (header.be(4) != MAGIC or header.u8() != 1) {
+                fail("not a TSM file (or unsupported version)");
+            }
+            index_offset_ = footer.be(8);
+            if (index_offset_ < HEADER_SIZE or index_offset_ > size_ - 8) {
+                fail("corrupt TSM index offset");
+            }
+        }
+
+        ~File() { release(); }
+
+        File(const File &) = delete;
+        File & operator=(const File &) = delete;
+
+        const std::string & filename() const { return filename_; }
+
+        /* Call f(key, type, entries) for each key in the index, in index (sorted) order.
+         * Entries are only decoded for keys where wanted(key) is true. */
+        template <class Wanted, class F>
+        void for_each_key(Wanted && wanted, F && f) const {
+            detail::Bytes index{map_ + index_offset_, size_ - 8 - index_offset_};
+            std::vector<BlockEntry> entries;
+            while (index.remaining() > 0) {
+                const size_t key_size = index.be(2);
+                const std::string_view key{reinterpret_cast<const char *>(index.take(key_size)), key_size};
+                const BlockType type = BlockType(index.u8());
+                const size_t n_entries = index.be(2);
+                if (not wanted(key)) {
+                    index.take(n_entries * BLOCK_ENTRY_SIZE);
+                    continue;
+                }
+                entries.clear();
+                for (size_t i = 0; i < n_entries; i++) {
+                    BlockEntry entry{};
+                    entry.min_time = index.be(8);
+                    entry.max_time = index.be(8);
+                    entry.offset = index.be(8);
+                    entry.size = index.be(4);
+                    if (entry.offset < HEADER_SIZE or entry.size < 5 or entry.offset + entry.size > index_offset_) {
+                        detail::corrupt("block entry of " + std::string(key) + " in " + filename_);
+                    }
+                    entries.push_back(entry);
+                }
+                f(key, type, entries);
+            }
+        }
+
+        /* Decode only the timestamps of the block at entry */
+        void read_timestamps(const BlockEntry & entry, std::vector<uint64_t> & timestamps) const {
+            detail::Bytes timestamp_bytes{nullptr, 0}, values{nullptr, 0};
+            split_block(entry, timestamp_bytes, values);
+            detail::decode_timestamps(timestamp_bytes, timestamps);
+        }
+
+        /* Decode the block at entry */
+        void read_block(const BlockEntry & entry, Block & block) const {
+            detail::Bytes timestamps{nullptr, 0}, values{nullptr, 0};
+            block.type = split_block(entry, timestamps, values);
+            detail::decode_timestamps(timestamps, block.timestamps);
+
+            size_t n_values = 0;
+            switch (block.type) {
+                case BlockType::float64:
+                    detail::decode_floats(values, block.floats);
+                    n_values = block.floats.size();
+                    break;
+                case BlockType::integer:
+                case BlockType::unsigned64:
+                    detail::decode_integers(values, block.integers);
+                    n_values = block.integers.size();
+                    break;
+                case BlockType::string:
+                    detail::decode_strings(values, block.string_data, block.strings);
+                    n_values = block.strings.size();
+                    break;
+                default:
+                    throw std::runtime_error("unsupported TSM block type " + std::to_string(int(block.type))
+                                             + " in " + filename_);
+            }
+            if (n_values != block.timestamps.size()) {
+                detail::corrupt("block with " + std::to_string(block.timestamps.size()) + " timestamps but "
+                                + std::to_string(n_values) + " values in " + filename_);
+            }
+        }
+    };
+}
+
+#endif